@@ -0,0 +1,85 @@
+// Just enough of the Arduino API to build MFIButton on a PC. The pins and
+// the clock are simulated, see host.h.
+#ifndef _MFIBUTTON_HOST_ARDUINO_H
+#define _MFIBUTTON_HOST_ARDUINO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+
+// Every pin below HOST_PINS has an interrupt, the rest get polled
+#define HOST_PINS 128
+#define NOT_AN_INTERRUPT -1
+#define digitalPinToInterrupt(p) ((p) < HOST_PINS ? (int)(p) : NOT_AN_INTERRUPT)
+
+// Define HOST_PORT_REGISTERS to have pins read through port registers, 32
+// pins per register. There are registers for every pin number, including
+// the polled pins past HOST_PINS, so no pin reads outside of them.
+#ifdef HOST_PORT_REGISTERS
+#define HOST_PORTS (256 / 32)
+extern volatile uint32_t host_ports[HOST_PORTS];
+#define digitalPinToPort(p) ((p) / 32)
+#define digitalPinToBitMask(p) ((uint32_t)1 << ((p) % 32))
+#define portInputRegister(port) (&host_ports[port])
+#endif
+
+unsigned long millis();
+unsigned long micros();
+void delayMicroseconds(unsigned int us);
+int digitalRead(uint8_t pin);
+void digitalWrite(uint8_t pin, uint8_t value);
+void pinMode(uint8_t pin, uint8_t mode);
+void attachInterrupt(uint8_t interrupt, void (*handler)(), int mode);
+void detachInterrupt(uint8_t interrupt);
+// Handlers are only ever called from the thread that changes the pins
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+// Numbers are printed in decimal only
+class Print {
+   public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    size_t print(const char *s) {
+        size_t n = 0;
+        while (*s != '\0') {
+            n += this->write((uint8_t)*s++);
+        }
+        return n;
+    }
+    size_t print(char c) { return this->write((uint8_t)c); }
+    size_t print(unsigned char n) { return this->print((unsigned long)n); }
+    size_t print(int n) { return this->print((long)n); }
+    size_t print(unsigned int n) { return this->print((unsigned long)n); }
+    size_t print(long n) {
+        char buffer[24];
+        snprintf(buffer, sizeof(buffer), "%ld", n);
+        return this->print(buffer);
+    }
+    size_t print(unsigned long n) {
+        char buffer[24];
+        snprintf(buffer, sizeof(buffer), "%lu", n);
+        return this->print(buffer);
+    }
+    size_t println() { return this->print("\r\n"); }
+    template <typename T>
+    size_t println(T value) {
+        size_t n = this->print(value);
+        return n + this->println();
+    }
+};
+
+#endif  // _MFIBUTTON_HOST_ARDUINO_H
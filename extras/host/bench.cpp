@@ -0,0 +1,339 @@
+// Measures what the interrupt handlers cost on the host, against the number
+// of buttons, long press stages and pending timers. The numbers only mean
+// something relative to each other, and to earlier runs on the same machine:
+// build the configurations side by side to compare them, and keep a baseline
+// to catch regressions.
+//
+// bench [--save FILE] [--compare FILE] [--tolerance PERCENT]
+
+#include <stdio.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "MFIButton.h"
+#include "host.h"
+
+// Presses per batch, and batches per measurement. The fastest batch counts,
+// the others are more likely to have been disturbed.
+static const int PRESSES = 2000;
+static const int BATCHES = 7;
+// Seconds before a scenario counts as hung
+static const int SCENARIO_TIMEOUT = 60;
+
+static unsigned long events = 0;
+
+static void count_event() { events++; }
+
+// A change that breaks the handlers shouldn't pass for being fast, so each
+// scenario checks that it got the events it should have.
+static void expect_events(const char *scenario, unsigned long expected) {
+    if (events != expected) {
+        fprintf(stderr, "%s: %lu events, expected %lu\n", scenario, events,
+                expected);
+        _exit(1);
+    }
+}
+
+struct cost_t {
+    double pin_ns;
+    double timer_ns;
+    double press_ns;
+};
+
+// Presses and releases the button on pin, and returns the cost per pin
+// interrupt, per timer interrupt and per whole press. setup runs before each
+// batch, and isn't measured.
+static cost_t measure(uint8_t pin, unsigned long hold, unsigned long gap,
+                      int presses = PRESSES, void (*setup)() = NULL) {
+    cost_t best = {0, 0, 0};
+    for (int batch = 0; batch < BATCHES; batch++) {
+        if (setup != NULL) {
+            setup();
+        }
+        host_handler_time_t pin_start = host_pin_time;
+        host_handler_time_t timer_start = host_timer_time;
+        for (int i = 0; i < presses; i++) {
+            host_set_pin(pin, false);
+            host_advance(hold);
+            host_set_pin(pin, true);
+            host_advance(gap);
+        }
+        uint64_t pin_ns = host_pin_time.ns - pin_start.ns;
+        uint64_t pin_calls = host_pin_time.calls - pin_start.calls;
+        uint64_t timer_ns = host_timer_time.ns - timer_start.ns;
+        uint64_t timer_calls = host_timer_time.calls - timer_start.calls;
+        cost_t cost;
+        cost.pin_ns = pin_calls ? (double)pin_ns / pin_calls : 0;
+        cost.timer_ns = timer_calls ? (double)timer_ns / timer_calls : 0;
+        cost.press_ns = (double)(pin_ns + timer_ns) / presses;
+        if (batch == 0 || cost.press_ns < best.press_ns) {
+            best = cost;
+        }
+    }
+    return best;
+}
+
+static MFIButton *make_button(uint8_t pin) {
+    MFIButton *button = new MFIButton(pin);
+    button->onClick(count_event);
+    button->onDoubleClick(count_event);
+    button->onLongPress(1000, count_event);
+    button->begin();
+    return button;
+}
+
+typedef std::vector<std::pair<std::string, double> > results_t;
+
+// end() stops buttons, but the timer pool, the clock and the pins would
+// still carry over from one scenario to the next. So every scenario runs in
+// its own process, and sends its results back through a pipe.
+static void run(results_t &results, void (*scenario)(int, FILE *), int n) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("pipe");
+        exit(2);
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        FILE *out = fdopen(fds[1], "w");
+        // A scenario that hangs in a handler fails instead of stalling
+        alarm(SCENARIO_TIMEOUT);
+        host_begin();
+        // A press right at the start would be taken for bounce
+        host_advance(1000);
+        scenario(n, out);
+        fclose(out);
+        _exit(0);
+    }
+    close(fds[1]);
+    FILE *in = fdopen(fds[0], "r");
+    char name[64];
+    double value;
+    while (fscanf(in, "%63s %lf", name, &value) == 2) {
+        results.push_back(std::make_pair(std::string(name), value));
+    }
+    fclose(in);
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "scenario failed\n");
+        exit(2);
+    }
+}
+
+// n buttons, and the one that was started first gets pressed. That's the
+// last one the shared handler gets to.
+static void buttons_scenario(int n, FILE *out) {
+    for (int i = 0; i < n; i++) {
+        make_button(i);
+    }
+    cost_t cost = measure(0, 50, 400);
+    // Far enough apart to be single clicks
+    expect_events("buttons", PRESSES * BATCHES);
+    fprintf(out, "buttons_%d.pin_ns %f\n", n, cost.pin_ns);
+    fprintf(out, "buttons_%d.press_ns %f\n", n, cost.press_ns);
+}
+
+// One button with n long press stages, 100ms apart, held through all of
+// them.
+static void stages_scenario(int n, FILE *out) {
+    MFIButton *button = make_button(0);
+    for (int i = 2; i <= n; i++) {
+        button->onLongPress(1000 + (i - 1) * 100, count_event);
+    }
+    cost_t cost = measure(0, 1000 + n * 100, 100);
+    expect_events("stages", (unsigned long)n * PRESSES * BATCHES);
+    fprintf(out, "stages_%d.timer_ns %f\n", n, cost.timer_ns);
+    fprintf(out, "stages_%d.press_ns %f\n", n, cost.press_ns);
+}
+
+static int holders = 0;
+
+// Presses the holders again, so their long press timers are due after the
+// batch.
+static void press_holders() {
+    for (int i = 1; i <= holders; i++) {
+        host_set_pin(i, true);
+    }
+    host_advance(MFI_BUTTON_DEFAULT_DEBOUNCE + 1);
+    for (int i = 1; i <= holders; i++) {
+        host_set_pin(i, false);
+    }
+    host_advance(MFI_BUTTON_DEFAULT_DEBOUNCE + 1);
+}
+
+// n other buttons are held down, so their long press timers are pending
+// for the whole batch. The measured button's long press is due after them,
+// so it has to go past all of them to be queued.
+static void depth_scenario(int n, FILE *out) {
+    MFIButton *target = new MFIButton(0);
+    target->onClick(count_event);
+    target->onLongPress(65535, count_event);
+    target->begin();
+    holders = n;
+    for (int i = 1; i <= n; i++) {
+        MFIButton *button = new MFIButton(i);
+        button->onLongPress(65000, count_event);
+        button->begin();
+    }
+    // 100 presses take 45 seconds, well before any long press is due
+    cost_t cost = measure(0, 50, 400, 100, press_holders);
+    expect_events("depth", 100 * BATCHES);
+    fprintf(out, "depth_%d.pin_ns %f\n", n, cost.pin_ns);
+    fprintf(out, "depth_%d.press_ns %f\n", n, cost.press_ns);
+}
+
+// Repeats as fast as they go, held for n ms. An interval of 0 is taken as
+// 1ms, and the first repeat comes right at the press.
+static void repeat_scenario(int n, FILE *out) {
+    MFIButton *button = new MFIButton(0);
+    button->onRepeat(0, 0, count_event);
+    button->begin();
+    cost_t cost = measure(0, n, 400, 100);
+    expect_events("repeat", (unsigned long)(n + 1) * 100 * BATCHES);
+    fprintf(out, "repeat_%d.timer_ns %f\n", n, cost.timer_ns);
+    fprintf(out, "repeat_%d.press_ns %f\n", n, cost.press_ns);
+}
+
+// An edge of the last of n buttons on the shared handler, which is the
+// slowest to get to. Every edge costs a pin interrupt, plus its share of the
+// timer work, so the inverse is the most edges per second the handlers could
+// keep up with.
+static void edge_scenario(int n, FILE *out) {
+    for (int i = 0; i < n; i++) {
+        make_button(i);
+    }
+    cost_t cost = measure(0, 50, 400);
+    expect_events("edge", PRESSES * BATCHES);
+    fprintf(out, "edge.ns %f\n", cost.press_ns / 2);
+}
+
+// A fixed amount of plain work, to tell how fast the machine happens to be
+// running. Results are compared relative to it.
+static double calibrate() {
+    double best = 0;
+    for (int batch = 0; batch < BATCHES; batch++) {
+        auto start = std::chrono::steady_clock::now();
+        volatile uint32_t sink = 0;
+        uint32_t x = 1;
+        for (int i = 0; i < 1000000; i++) {
+            x = x * 1664525 + 1013904223;
+            sink = x;
+        }
+        (void)sink;
+        double ns = std::chrono::duration<double, std::nano>(
+                        std::chrono::steady_clock::now() - start)
+                        .count() /
+                    1000;
+        if (batch == 0 || ns < best) {
+            best = ns;
+        }
+    }
+    return best;
+}
+
+static bool load(const char *path, std::map<std::string, double> &values) {
+    FILE *in = fopen(path, "r");
+    if (in == NULL) {
+        return false;
+    }
+    char name[64];
+    double value;
+    while (fscanf(in, "%63s %lf", name, &value) == 2) {
+        values[name] = value;
+    }
+    fclose(in);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    const char *save = NULL;
+    const char *compare = NULL;
+    double tolerance = 25;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--save" && i + 1 < argc) {
+            save = argv[++i];
+        } else if (arg == "--compare" && i + 1 < argc) {
+            compare = argv[++i];
+        } else if (arg == "--tolerance" && i + 1 < argc) {
+            tolerance = atof(argv[++i]);
+        } else {
+            fprintf(stderr,
+                    "usage: %s [--save FILE] [--compare FILE] "
+                    "[--tolerance PERCENT]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+
+    results_t results;
+    results.push_back(std::make_pair(std::string("calibration"), calibrate()));
+    const int buttons[] = {1, 2, 4, 8, 16, 32};
+    for (int n : buttons) {
+        run(results, buttons_scenario, n);
+    }
+    const int stages[] = {1, 2, 4, 8, 16};
+    for (int n : stages) {
+        run(results, stages_scenario, n);
+    }
+    const int depths[] = {0, 8, 32, 64};
+    for (int n : depths) {
+        run(results, depth_scenario, n);
+    }
+    run(results, repeat_scenario, 100);
+    run(results, edge_scenario, 32);
+
+    std::map<std::string, double> baseline;
+    bool have_baseline = compare != NULL && load(compare, baseline);
+    if (compare != NULL && !have_baseline) {
+        printf("no baseline in %s, run with --save first\n", compare);
+    }
+    // How much slower the machine is running than for the baseline
+    double speed = 1;
+    if (baseline.count("calibration") != 0) {
+        speed = results[0].second / baseline["calibration"];
+    }
+    int regressions = 0;
+    for (auto &result : results) {
+        printf("%-20s %10.1f ns", result.first.c_str(), result.second);
+        auto base = baseline.find(result.first);
+        if (result.first != "calibration" && base != baseline.end() &&
+            base->second > 0) {
+            double change = (result.second / speed / base->second - 1) * 100;
+            printf("  %+6.1f%%", change);
+            if (change > tolerance) {
+                printf("  REGRESSION");
+                regressions++;
+            }
+        }
+        printf("\n");
+        if (result.first == "edge.ns" && result.second > 0) {
+            printf("%-20s %10.0f edges/s\n", "max edge rate",
+                   1e9 / result.second);
+        }
+    }
+    if (save != NULL) {
+        FILE *out = fopen(save, "w");
+        if (out == NULL) {
+            perror(save);
+            return 2;
+        }
+        for (auto &result : results) {
+            fprintf(out, "%s %f\n", result.first.c_str(), result.second);
+        }
+        fclose(out);
+    }
+    if (regressions != 0) {
+        printf("%d regressions of more than %.0f%%\n", regressions,
+               tolerance);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,106 @@
+#include "host.h"
+
+#include <chrono>
+
+#include "MFIButton.h"
+
+#ifdef HOST_PORT_REGISTERS
+volatile uint32_t host_ports[HOST_PORTS];
+#endif
+
+host_handler_time_t host_pin_time = {0, 0};
+host_handler_time_t host_timer_time = {0, 0};
+
+static unsigned long host_clock = 0;
+static unsigned long host_deadline = 0;
+static bool host_timer_armed = false;
+// Pins read high until they're set, like with the pull-ups on
+static bool host_levels[256];
+static bool host_levels_set[256];
+static void (*host_handlers[HOST_PINS])();
+
+static uint64_t host_clock_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+unsigned long millis() { return host_clock; }
+
+unsigned long micros() { return host_clock * 1000; }
+
+void delayMicroseconds(unsigned int us) { (void)us; }
+
+int digitalRead(uint8_t pin) {
+    if (!host_levels_set[pin]) {
+        return HIGH;
+    }
+    return host_levels[pin] ? HIGH : LOW;
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+    host_levels_set[pin] = true;
+    host_levels[pin] = value != LOW;
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+    (void)pin;
+    (void)mode;
+}
+
+void attachInterrupt(uint8_t interrupt, void (*handler)(), int mode) {
+    (void)mode;
+    host_handlers[interrupt] = handler;
+}
+
+void detachInterrupt(uint8_t interrupt) { host_handlers[interrupt] = NULL; }
+
+static void host_set_timer(unsigned long ticks) {
+    host_deadline = host_clock + ticks;
+    host_timer_armed = true;
+}
+
+void host_begin() {
+#ifdef HOST_PORT_REGISTERS
+    for (uint8_t i = 0; i < HOST_PORTS; i++) {
+        host_ports[i] = 0xFFFFFFFF;
+    }
+#endif
+    MFIButton::setInterruptTimerTickCallback(host_set_timer);
+}
+
+void host_set_pin(uint8_t pin, bool high) {
+    bool changed = digitalRead(pin) != (high ? HIGH : LOW);
+    digitalWrite(pin, high ? HIGH : LOW);
+#ifdef HOST_PORT_REGISTERS
+    uint32_t bit = digitalPinToBitMask(pin);
+    if (high) {
+        host_ports[digitalPinToPort(pin)] |= bit;
+    } else {
+        host_ports[digitalPinToPort(pin)] &= ~bit;
+    }
+#endif
+    if (!changed || pin >= HOST_PINS || host_handlers[pin] == NULL) {
+        return;
+    }
+    uint64_t start = host_clock_ns();
+    host_handlers[pin]();
+    host_pin_time.ns += host_clock_ns() - start;
+    host_pin_time.calls++;
+}
+
+void host_advance(unsigned long ms) {
+    unsigned long target = host_clock + ms;
+    while (host_timer_armed && (long)(host_deadline - target) <= 0) {
+        host_clock = host_deadline;
+        host_timer_armed = false;
+        uint64_t start = host_clock_ns();
+        MFIButton::timerInterruptHandler();
+        host_timer_time.ns += host_clock_ns() - start;
+        host_timer_time.calls++;
+    }
+    host_clock = target;
+    MFIButton::dispatch();
+}
+
+unsigned long host_now() { return host_clock; }
@@ -0,0 +1,31 @@
+// Simulated pins and a virtual clock, for running MFIButton on a PC. Time
+// only moves in host_advance(), which runs the button timers when they're
+// due, like the hardware timer interrupt would. Changing a pin calls its
+// interrupt handler right away.
+#ifndef _MFIBUTTON_HOST_H
+#define _MFIBUTTON_HOST_H
+
+#include <stdint.h>
+
+#include "Arduino.h"
+
+// Time spent in the interrupt handlers, measured on the host's clock. That
+// includes reading the clock, which is about the same every time.
+struct host_handler_time_t {
+    uint64_t calls;
+    uint64_t ns;
+};
+
+// Sets the button timer callback, call this before any begin()
+void host_begin();
+// Sets the level of a pin, and calls its interrupt handler if it changed
+void host_set_pin(uint8_t pin, bool high);
+// Moves the clock forward, firing the timers that come due on the way, and
+// then calls MFIButton::dispatch().
+void host_advance(unsigned long ms);
+unsigned long host_now();
+
+extern host_handler_time_t host_pin_time;
+extern host_handler_time_t host_timer_time;
+
+#endif  // _MFIBUTTON_HOST_H
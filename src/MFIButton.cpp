@@ -2,181 +2,1042 @@
 
 #include "assert.h"
 
-// TODO: Make time math resilient to clock overflow wraps
-// TODO: Add the option to only fire a long press at release
+#if MFI_BUTTON_CHORDS
+#include "MFIButtonChord.h"
+#endif
+
+#if defined(ESP32) && MFI_BUTTON_CORE >= 0 && !CONFIG_FREERTOS_UNICORE
+#include "esp_ipc.h"
+#define MFI_BUTTON_PIN_TO_CORE
+#endif
+
+#ifdef MFI_BUTTON_HAS_SPINLOCK
+#define MFI_BUTTON_ENTER_CRITICAL() MFIButton::enter_critical_()
+#define MFI_BUTTON_EXIT_CRITICAL() MFIButton::exit_critical_()
+#else
+// Interrupt handlers never run at the same time on the other cores
+#define MFI_BUTTON_ENTER_CRITICAL()
+#define MFI_BUTTON_EXIT_CRITICAL()
+#endif
+
+// For copying what the handlers keep from loop() on any core, while the
+// handlers run
+#ifdef MFI_BUTTON_HAS_SPINLOCK
+#define MFI_BUTTON_READ_BEGIN() MFIButton::enter_critical_()
+#define MFI_BUTTON_READ_END() MFIButton::exit_critical_()
+#else
+#define MFI_BUTTON_READ_BEGIN() noInterrupts()
+#define MFI_BUTTON_READ_END() interrupts()
+#endif
+
+#if MFI_BUTTON_STATS
+#define MFI_BUTTON_STAT(statement) statement
+// Cortex-M3 and up have a cycle counter, but it has to be turned on
+#if !defined(ESP32) && !defined(ESP8266) && defined(DWT_CTRL_CYCCNTENA_Msk)
+#define MFI_BUTTON_STATS_DWT
+#endif
+#else
+#define MFI_BUTTON_STAT(statement)
+#endif
+
+// Around each pass of the interrupt handlers, for events that are batched
+#if MFI_BUTTON_BATCH_EVENTS
+#define MFI_BUTTON_BATCH_BEGIN() MFIButton::begin_batch_()
+#define MFI_BUTTON_BATCH_END() MFIButton::end_batch_()
+#else
+#define MFI_BUTTON_BATCH_BEGIN()
+#define MFI_BUTTON_BATCH_END()
+#endif
+
+#if MFI_BUTTON_TRACE
+#define MFI_BUTTON_TRACE_RECORD(type, button, value, time) \
+    MFIButton::trace_(MFIButtonTraceRecord::type, button, value, time)
+#else
+#define MFI_BUTTON_TRACE_RECORD(type, button, value, time)
+#endif
+
+// The timer queues, as a TAILQ, or linked by pool index when compact
+#if MFI_BUTTON_COMPACT
+#define MFI_BUTTON_TIMERS_INITIALIZER(head) \
+    { MFIButton::NO_TIMER_, MFIButton::NO_TIMER_ }
+#define MFI_BUTTON_TIMERS_INIT(head) \
+    ((head)->first = (head)->last = MFIButton::NO_TIMER_)
+#define MFI_BUTTON_TIMERS_EMPTY(head) ((head)->first == MFIButton::NO_TIMER_)
+#define MFI_BUTTON_TIMERS_FIRST(head) MFIButton::timer_at_((head)->first)
+#define MFI_BUTTON_TIMERS_NEXT(timer) \
+    MFIButton::timer_at_((timer)->entries.next)
+#define MFI_BUTTON_TIMERS_INSERT_HEAD(head, timer) \
+    MFIButton::timers_insert_before_(head, MFI_BUTTON_TIMERS_FIRST(head), timer)
+#define MFI_BUTTON_TIMERS_INSERT_TAIL(head, timer) \
+    MFIButton::timers_insert_before_(head, NULL, timer)
+#define MFI_BUTTON_TIMERS_INSERT_BEFORE(head, before, timer) \
+    MFIButton::timers_insert_before_(head, before, timer)
+#define MFI_BUTTON_TIMERS_REMOVE(head, timer) \
+    MFIButton::timers_remove_(head, timer)
+#else
+#define MFI_BUTTON_TIMERS_INITIALIZER(head) TAILQ_HEAD_INITIALIZER(head)
+#define MFI_BUTTON_TIMERS_INIT(head) TAILQ_INIT(head)
+#define MFI_BUTTON_TIMERS_EMPTY(head) TAILQ_EMPTY(head)
+#define MFI_BUTTON_TIMERS_FIRST(head) TAILQ_FIRST(head)
+#define MFI_BUTTON_TIMERS_NEXT(timer) TAILQ_NEXT(timer, entries)
+#define MFI_BUTTON_TIMERS_INSERT_HEAD(head, timer) \
+    TAILQ_INSERT_HEAD(head, timer, entries)
+#define MFI_BUTTON_TIMERS_INSERT_TAIL(head, timer) \
+    TAILQ_INSERT_TAIL(head, timer, entries)
+#define MFI_BUTTON_TIMERS_INSERT_BEFORE(head, before, timer) \
+    TAILQ_INSERT_BEFORE(before, timer, entries)
+#define MFI_BUTTON_TIMERS_REMOVE(head, timer) TAILQ_REMOVE(head, timer, entries)
+#endif
+#define MFI_BUTTON_TIMERS_FOREACH(timer, head)                       \
+    for ((timer) = MFI_BUTTON_TIMERS_FIRST(head); (timer) != NULL; \
+         (timer) = MFI_BUTTON_TIMERS_NEXT(timer))
 
 struct MFIButton::all_buttons_head_ MFIButton::started_buttons_ =
     SLIST_HEAD_INITIALIZER(started_buttons_);
 
+#if MFI_BUTTON_TIMER_WHEEL
+// The slots are initialized along with the timer pool
+struct MFIButton::timers_head_ MFIButton::wheel_[MFI_BUTTON_TIMER_WHEEL_SLOTS];
+uint32_t MFIButton::wheel_used_ = 0;
+MFIButton::timer_t_ *MFIButton::wheel_first_ = NULL;
+#else
 struct MFIButton::timers_head_ MFIButton::timers_ =
-    TAILQ_HEAD_INITIALIZER(timers_);
+    MFI_BUTTON_TIMERS_INITIALIZER(timers_);
+#endif
 
 MFIButton::timer_callback_t MFIButton::set_timer_ = NULL;
+MFIButton::tick_timer_callback_t MFIButton::set_tick_timer_ = NULL;
+
+struct MFIButton::timers_head_ MFIButton::free_timers_ =
+    MFI_BUTTON_TIMERS_INITIALIZER(free_timers_);
+
+MFIButton::timer_t_ MFIButton::timer_pool_[MFI_BUTTON_TIMER_POOL_SIZE];
+bool MFIButton::timer_pool_ready_ = false;
+volatile uint16_t MFIButton::timer_pool_exhausted_ = 0;
+uint8_t MFIButton::timers_in_use_ = 0;
+#if MFI_BUTTON_COMPACT
+unsigned long MFIButton::last_edge_time_ = 0;
+#endif
+MFIButtonProfile MFIButton::default_profile_;
+#if MFI_BUTTON_STATS
+MFIButtonStats MFIButton::stats_ = {};
+#endif
+#if MFI_BUTTON_TRACE
+MFIButtonTraceRecord MFIButton::trace_ring_[MFI_BUTTON_TRACE_SIZE];
+uint16_t MFIButton::trace_head_ = 0;
+bool MFIButton::trace_wrapped_ = false;
+uint8_t MFIButton::next_trace_id_ = 0;
+bool MFIButton::replaying_ = false;
+
+// Defined before its callers, so it's inlined into them
+inline void MFI_BUTTON_ISR_ATTR MFIButton::trace_(uint8_t type,
+                                                  const MFIButton *button,
+                                                  uint16_t value,
+                                                  unsigned long time) {
+    MFIButtonTraceRecord *record =
+        &MFIButton::trace_ring_[MFIButton::trace_head_];
+    record->time = time;
+    record->type = type;
+    record->button = button->trace_id_;
+    record->value = value;
+    MFIButton::trace_head_ =
+        (MFIButton::trace_head_ + 1) & (MFI_BUTTON_TRACE_SIZE - 1);
+    if (MFIButton::trace_head_ == 0) {
+        MFIButton::trace_wrapped_ = true;
+    }
+}
+#endif
+
+#ifdef MFI_BUTTON_HAS_SPINLOCK
+portMUX_TYPE MFIButton::spinlock_ = portMUX_INITIALIZER_UNLOCKED;
+#endif
+#if defined(MFI_BUTTON_HAS_SPINLOCK) || MFI_BUTTON_BATCH_EVENTS
+MFIButton::pending_events_t_ MFIButton::pending_;
+#endif
+#if MFI_BUTTON_BATCH_EVENTS
+MFIButton::events_callback_t MFIButton::on_events_ = NULL;
+bool MFIButton::coalesce_ = false;
+uint8_t MFIButton::batch_depth_ = 0;
+#endif
+
+#if MFI_BUTTON_DEFERRED_DISPATCH
+MFIButton::queued_event_t_ MFIButton::event_queue_[MFI_BUTTON_EVENT_QUEUE_SIZE];
+volatile uint8_t MFIButton::event_queue_head_ = 0;
+volatile uint8_t MFIButton::event_queue_tail_ = 0;
+volatile uint16_t MFIButton::event_queue_overflows_ = 0;
+#endif
+
+struct MFIButton::scanners_head_ MFIButton::work_scanners_ =
+    SLIST_HEAD_INITIALIZER(work_scanners_);
+volatile bool MFIButton::work_requested_ = false;
+#ifdef MFI_BUTTON_HAS_FREERTOS
+TaskHandle_t volatile MFIButton::dispatch_task_ = NULL;
+#endif
+
+struct MFIButton::all_buttons_head_ MFIButton::scanned_buttons_ =
+    SLIST_HEAD_INITIALIZER(scanned_buttons_);
+struct MFIButton::all_buttons_head_ MFIButton::polled_buttons_ =
+    SLIST_HEAD_INITIALIZER(polled_buttons_);
+MFIButton::timer_t_ *MFIButton::poll_timer_ = NULL;
+
+#ifdef MFI_BUTTON_HAS_PORT_REGISTERS
+MFIButton::port_group_t_ MFIButton::port_groups_[MFI_BUTTON_PORT_GROUPS];
+uint8_t MFIButton::port_group_count_ = 0;
+#endif
+
+#if MFI_BUTTON_DIRECT_DISPATCH && !defined(MFI_BUTTON_HAS_INTERRUPT_ARG)
+MFIButton *MFIButton::dispatch_slots_[MFI_BUTTON_DISPATCH_SLOTS] = {NULL};
+
+// Each slot gets its own handler, so that the handler knows which button to
+// go to without having to look at any pins. get() walks down the slots to
+// find the right handler, which is only done in begin(). Template code
+// ignores MFI_BUTTON_ISR_ATTR, so the handlers stay in flash, but all they do
+// is call direct_interrupt_handler_().
+template <uint8_t slot, bool first>
+struct MFIButton::slot_handler_ {
+    static void handle() {
+        MFIButton::direct_interrupt_handler_(MFIButton::dispatch_slots_[slot]);
+    }
+    static callback_t get(uint8_t n) {
+        return n == slot ? &handle : slot_handler_<slot - 1>::get(n);
+    }
+};
+
+template <uint8_t slot>
+struct MFIButton::slot_handler_<slot, true> {
+    static void handle() {
+        MFIButton::direct_interrupt_handler_(MFIButton::dispatch_slots_[slot]);
+    }
+    static callback_t get(uint8_t n) { return n == slot ? &handle : NULL; }
+};
+#endif
 
 bool MFIButton::begin() {
+    if (this->started_) {
+        return true;
+    }
     pinMode(pin_, pullup_ ? INPUT_PULLUP : INPUT);
+#ifdef MFI_BUTTON_HAS_PORT_REGISTERS
+    // Look up the register once, so reads don't have to go through the
+    // pin tables every time.
+#if defined(ARDUINO_ARCH_RP2040)
+    this->input_reg_ = &sio_hw->gpio_in;
+    this->bit_mask_ = (port_reg_t_)1 << this->pin_;
+#else
+    this->input_reg_ = (volatile port_reg_t_ *)portInputRegister(
+        digitalPinToPort(this->pin_));
+    this->bit_mask_ = digitalPinToBitMask(this->pin_);
+#endif
+#endif
     this->last_state_ = this->digital_read_();
-    // This library doesn't work unless you set up a timer callback
-    assert(MFIButton::set_timer_ != NULL);
+    MFIButton::init_timers_();
     // Check if the pin supports interrupts
-    if (digitalPinToInterrupt(this->pin_) == NOT_AN_INTERRUPT) {
-        return false;
+    int interrupt = digitalPinToInterrupt(this->pin_);
+    if (interrupt == NOT_AN_INTERRUPT) {
+        // Read along with the other polled buttons from the poll timer
+        this->polled_ = true;
+        MFIButton::lock_();
+        SLIST_INSERT_HEAD(&started_buttons_, this, started_entries_);
+        this->started_ = true;
+#ifdef MFI_BUTTON_HAS_PORT_REGISTERS
+        this->join_port_group_();
+#endif
+        SLIST_INSERT_HEAD(&polled_buttons_, this, scanned_entries_);
+        MFIButton::schedule_poll_(MFIButton::now_());
+        MFIButton::unlock_();
+        return true;
+    }
+#if MFI_BUTTON_GLITCH_FILTER
+    gpio_pin_glitch_filter_config_t filter_config = {};
+    filter_config.clk_src = GLITCH_FILTER_CLK_SRC_DEFAULT;
+    filter_config.gpio_num = (gpio_num_t)this->pin_;
+    if (gpio_new_pin_glitch_filter(&filter_config, &this->glitch_filter_) ==
+        ESP_OK) {
+        gpio_glitch_filter_enable(this->glitch_filter_);
+    } else {
+        this->glitch_filter_ = NULL;
     }
-    // Add this button to the list of started buttons, so that
-    // the interrupt handler can check it.
+#endif
+    MFIButton::lock_();
+    // Add this button to the list of started buttons
     SLIST_INSERT_HEAD(&started_buttons_, this, started_entries_);
+    this->started_ = true;
+#if MFI_BUTTON_DIRECT_DISPATCH && defined(MFI_BUTTON_HAS_INTERRUPT_ARG)
+    MFIButton::unlock_();
+    // The core passes us the button, so every pin can dispatch directly.
+    this->attach_interrupt_(interrupt, MFIButton::direct_interrupt_handler_,
+                            this);
+    return true;
+#else
+#if MFI_BUTTON_DIRECT_DISPATCH
+    if (interrupt < MFI_BUTTON_DISPATCH_SLOTS &&
+        dispatch_slots_[interrupt] == NULL) {
+        // Fill the slot before attaching, so the handler never sees NULL
+        dispatch_slots_[interrupt] = this;
+        MFIButton::unlock_();
+        this->attach_interrupt_(
+            interrupt,
+            slot_handler_<MFI_BUTTON_DISPATCH_SLOTS - 1>::get(interrupt));
+        return true;
+    }
+    // No slot available, so fall through to the shared handler.
+#endif
+    // Add this button to the list of scanned buttons, so that
+    // the shared interrupt handler can check it.
+#ifdef MFI_BUTTON_HAS_PORT_REGISTERS
+    this->join_port_group_();
+#endif
+    SLIST_INSERT_HEAD(&scanned_buttons_, this, scanned_entries_);
+    MFIButton::unlock_();
     // Attach our pin interrupt handler to the pin
-    attachInterrupt(digitalPinToInterrupt(this->pin_),
-                    MFIButton::pin_interrupt_handler_, CHANGE);
+    this->attach_interrupt_(interrupt, MFIButton::pin_interrupt_handler_);
     return true;
+#endif
+}
+
+void MFIButton::end() {
+    if (!this->started_) {
+        return;
+    }
+    int interrupt = digitalPinToInterrupt(this->pin_);
+    // Stop the debounce timer first, or it could attach the interrupt
+    // again after it's detached.
+    MFIButton::lock_();
+#if MFI_BUTTON_DEBOUNCE_MASKING
+    MFIButton::cancel_timer_(&this->debounce_timer_);
+#endif
+    this->started_ = false;
+    MFIButton::unlock_();
+    // No more edges from here, the lock below waits for any handler that
+    // is still running on the other core.
+    if (!this->polled_) {
+        detachInterrupt(interrupt);
+    }
+#if MFI_BUTTON_GLITCH_FILTER
+    if (this->glitch_filter_ != NULL) {
+        gpio_glitch_filter_disable(this->glitch_filter_);
+        gpio_del_glitch_filter(this->glitch_filter_);
+        this->glitch_filter_ = NULL;
+    }
+#endif
+    MFIButton::lock_();
+    SLIST_REMOVE(&started_buttons_, this, MFIButton, started_entries_);
+    bool scanned = !this->polled_;
+#if MFI_BUTTON_DIRECT_DISPATCH && defined(MFI_BUTTON_HAS_INTERRUPT_ARG)
+    // The handler was given the button, it's on no other list
+    scanned = false;
+#elif MFI_BUTTON_DIRECT_DISPATCH
+    if (scanned && interrupt < MFI_BUTTON_DISPATCH_SLOTS &&
+        dispatch_slots_[interrupt] == this) {
+        dispatch_slots_[interrupt] = NULL;
+        scanned = false;
+    }
+#endif
+    if (this->polled_) {
+        // The poll timer stops by itself when no polled buttons are left
+        SLIST_REMOVE(&polled_buttons_, this, MFIButton, scanned_entries_);
+    } else if (scanned) {
+        SLIST_REMOVE(&scanned_buttons_, this, MFIButton, scanned_entries_);
+    }
+#ifdef MFI_BUTTON_HAS_PORT_REGISTERS
+    if (this->port_group_ != NO_PORT_GROUP_) {
+        port_group_t_ *group = &MFIButton::port_groups_[this->port_group_];
+        group->mask &= ~this->bit_mask_;
+        group->invert &= ~this->bit_mask_;
+        this->port_group_ = NO_PORT_GROUP_;
+    }
+#endif
+    MFIButton::cancel_timer_(&this->sequence_timer_);
+    MFIButton::cancel_timer_(&this->long_press_timer_);
+    MFIButton::cancel_timer_(&this->repeat_timer_);
+#if MFI_BUTTON_DEBOUNCE_MASKING
+    // A debounce window that started before the interrupt was detached
+    MFIButton::cancel_timer_(&this->debounce_timer_);
+#endif
+#if MFI_BUTTON_CHORDS
+    if (this->chord_index_ != NO_CHORD_) {
+        MFIButtonChord::released_(this, false);
+    }
+#endif
+    this->sequence_clicks_ = 0;
+    this->polled_ = false;
+    MFIButton::unlock_();
+}
+
+#ifdef MFI_BUTTON_PIN_TO_CORE
+struct mfi_attach_request_t {
+    int interrupt;
+    void (*handler)(void *);
+    void *arg;
+    int mode;
+};
+
+static void mfi_attach_on_core(void *arg) {
+    mfi_attach_request_t *request = (mfi_attach_request_t *)arg;
+    attachInterruptArg(request->interrupt, request->handler, request->arg,
+                       request->mode);
+}
+
+static void MFI_BUTTON_ISR_ATTR mfi_call_handler(void *arg) {
+    ((MFIButton::callback_t)arg)();
+}
+#endif
+
+void MFIButton::init_timers_() {
+#if MFI_BUTTON_BUILTIN_TIMER
+    if (MFIButton::set_timer_ == NULL && MFIButton::set_tick_timer_ == NULL) {
+        MFIButton::useBuiltinTimer();
+    }
+#endif
+#ifdef MFI_BUTTON_STATS_DWT
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+    // This library doesn't work unless you set up a timer callback
+    assert(MFIButton::set_timer_ != NULL ||
+           MFIButton::set_tick_timer_ != NULL);
+    // This has to happen before any interrupts are attached, since the
+    // interrupt handlers take their timers from the pool.
+    MFI_BUTTON_ENTER_CRITICAL();
+    MFIButton::init_timer_pool_();
+    MFI_BUTTON_EXIT_CRITICAL();
+}
+
+void MFIButton::attach_interrupt_(int interrupt, callback_t handler) {
+#if MFI_BUTTON_DEBOUNCE_MASKING && !defined(ESP32) && \
+    !defined(ARDUINO_ARCH_RP2040)
+    this->interrupt_handler_ = handler;
+#endif
+    MFIButton::attach_handler_(interrupt, handler, CHANGE);
 }
 
-void MFIButton::pin_interrupt_handler_() {
+void MFIButton::attach_handler_(int interrupt, callback_t handler, int mode) {
+#ifdef MFI_BUTTON_PIN_TO_CORE
+    MFIButton::attach_interrupt_(interrupt, mfi_call_handler, (void *)handler,
+                                 mode);
+#else
+    attachInterrupt(interrupt, handler, mode);
+#endif
+}
+
+#ifdef MFI_BUTTON_HAS_INTERRUPT_ARG
+void MFIButton::attach_interrupt_(int interrupt, void (*handler)(void *),
+                                  void *arg, int mode) {
+#ifdef MFI_BUTTON_PIN_TO_CORE
+    // The interrupt gets allocated on the core that attaches it
+    mfi_attach_request_t request = {interrupt, handler, arg, mode};
+    if (xPortGetCoreID() == MFI_BUTTON_CORE) {
+        mfi_attach_on_core(&request);
+    } else {
+        esp_ipc_call_blocking(MFI_BUTTON_CORE, mfi_attach_on_core, &request);
+    }
+#else
+    attachInterruptArg(interrupt, handler, arg, mode);
+#endif
+}
+#endif
+
+#ifdef MFI_BUTTON_HAS_SPINLOCK
+void MFI_BUTTON_ISR_ATTR MFIButton::enter_critical_() {
+    // Works from both tasks and interrupt handlers
+    portENTER_CRITICAL_SAFE(&MFIButton::spinlock_);
+}
+
+void MFI_BUTTON_ISR_ATTR MFIButton::exit_critical_() {
+#if MFI_BUTTON_DEFERRED_DISPATCH
+    // Events go in the queue, or the batch is queued by end_batch_()
+    portEXIT_CRITICAL_SAFE(&MFIButton::spinlock_);
+#else
+#if MFI_BUTTON_BATCH_EVENTS
+    // Keep collecting while a pass is going on, as long as there's room for
+    // what the next change can emit.
+    if (MFIButton::batch_depth_ != 0 &&
+        MFIButton::pending_.count <= MFI_BUTTON_BATCH_SIZE - 2) {
+        portEXIT_CRITICAL_SAFE(&MFIButton::spinlock_);
+        return;
+    }
+#endif
+    // Copy the events out, the other core can have the lock as soon as it's
+    // released.
+    pending_events_t_ pending = MFIButton::pending_;
+    MFIButton::pending_.count = 0;
+    portEXIT_CRITICAL_SAFE(&MFIButton::spinlock_);
+    MFIButton::deliver_(pending.events, pending.count);
+#endif
+}
+#endif
+
+#if MFI_BUTTON_BATCH_EVENTS
+void MFIButton::onEvents(events_callback_t callback, bool coalesce) {
+    MFIButton::lock_();
+    MFIButton::on_events_ = callback;
+    MFIButton::coalesce_ = coalesce;
+    MFIButton::unlock_();
+}
+
+void MFI_BUTTON_ISR_ATTR MFIButton::begin_batch_() {
+    // Passes are also made from dispatch() and begin(), not only from the
+    // interrupt handlers, so this takes the full lock
+    MFIButton::lock_();
+    MFIButton::batch_depth_++;
+    MFIButton::unlock_();
+}
+
+void MFI_BUTTON_ISR_ATTR MFIButton::end_batch_() {
+    MFIButton::lock_();
+    // With both cores in a pass, the last one to finish hands over the
+    // events of both.
+    MFIButton::batch_depth_--;
+#if MFI_BUTTON_DEFERRED_DISPATCH || !defined(MFI_BUTTON_HAS_SPINLOCK)
+    if (MFIButton::batch_depth_ == 0 && MFIButton::pending_.count != 0) {
+        MFIButton::flush_batch_();
+    }
+#endif
+    // With the spinlock, this delivers the batch now that the pass is over
+    MFIButton::unlock_();
+}
+
+void MFI_BUTTON_ISR_ATTR MFIButton::flush_batch_() {
+    uint8_t count = MFIButton::pending_.count;
+    MFIButton::pending_.count = 0;
+#if MFI_BUTTON_DEFERRED_DISPATCH
+    MFIButton::queue_events_(MFIButton::pending_.events, count);
+#else
+    // Only the spinlock lets interrupt handlers run at the same time, and
+    // then this isn't used. So nothing adds to the batch in the meantime.
+    MFIButton::deliver_(MFIButton::pending_.events, count);
+#endif
+}
+#endif
+
+#if defined(MFI_BUTTON_HAS_SPINLOCK) || MFI_BUTTON_BATCH_EVENTS
+void MFI_BUTTON_ISR_ATTR MFIButton::deliver_(const queued_event_t_ *entries,
+                                            uint8_t count) {
+#if MFI_BUTTON_BATCH_EVENTS
+    events_callback_t on_events = MFIButton::on_events_;
+    if (on_events != NULL) {
+        MFIButtonEvent events[MFI_BUTTON_BATCH_SIZE];
+        uint8_t n = 0;
+        for (uint8_t i = 0; i < count; i++) {
+            const MFIButtonEvent &event = entries[i].event;
+            if (MFIButton::coalesce_ &&
+                event.type_ == MFIButtonEvent::RELEASE) {
+                // Drop the press it ends, if that's in this batch too
+                uint8_t j = n;
+                while (j > 0) {
+                    const MFIButtonEvent &earlier = events[j - 1];
+                    if (earlier.button_ == event.button_ &&
+                        earlier.type_ == MFIButtonEvent::PRESS) {
+                        break;
+                    }
+                    j--;
+                }
+                if (j > 0) {
+                    for (; j < n; j++) {
+                        events[j - 1] = events[j];
+                    }
+                    n--;
+                    continue;
+                }
+            }
+            events[n++] = event;
+        }
+        if (n != 0) {
+            on_events(events, n);
+        }
+        return;
+    }
+#endif
+    for (uint8_t i = 0; i < count; i++) {
+        entries[i].callback(entries[i].event);
+    }
+}
+#endif
+
+void MFI_BUTTON_ISR_ATTR MFIButton::pin_interrupt_handler_() {
     // This won't change throughout the handler, so just read
     // it once.
-    auto now = millis();
-    // Iterate through all the buttons that have been started
+    auto now = MFIButton::now_();
+    MFI_BUTTON_STAT(uint32_t start = MFIButton::stats_clock_());
+    // Iterate through all the buttons that share this handler, since we
+    // don't know which pin triggered it.
+    MFI_BUTTON_BATCH_BEGIN();
+    MFIButton::check_buttons_(&scanned_buttons_, now);
+    MFI_BUTTON_BATCH_END();
+#if MFI_BUTTON_STATS
+    MFI_BUTTON_ENTER_CRITICAL();
+    MFIButton::add_handler_time_(&MFIButton::stats_.pin_handler, start);
+    MFI_BUTTON_EXIT_CRITICAL();
+#endif
+}
+
+void MFI_BUTTON_ISR_ATTR MFIButton::check_buttons_(all_buttons_head_ *buttons,
+                                                   unsigned long now) {
+#ifdef MFI_BUTTON_HAS_PORT_REGISTERS
+    // Read every register once, and work out which buttons changed
+    port_reg_t_ input[MFI_BUTTON_PORT_GROUPS];
+    port_reg_t_ changed[MFI_BUTTON_PORT_GROUPS];
+    for (uint8_t i = 0; i < MFIButton::port_group_count_; i++) {
+        port_group_t_ *group = &MFIButton::port_groups_[i];
+        input[i] = *group->reg ^ group->invert;
+        changed[i] = (input[i] ^ group->state) & group->mask;
+    }
+#endif
     MFIButton *button = NULL;
-    SLIST_FOREACH(button, &started_buttons_, started_entries_) {
-        // First check if we are in a debounce period
-        if (now - button->last_press_time_ < button->debounce_time_ ||
-            now - button->last_release_time_ < button->debounce_time_) {
-            // Within debounce period, so we just ignore the whole event.
-            // On a press-release-press where only the release is within
-            // the debounce period, we will still get a second press event,
-            // which will be ignored because it won't be a state change.
+    SLIST_FOREACH(button, buttons, scanned_entries_) {
+#ifdef MFI_BUTTON_HAS_PORT_REGISTERS
+        if (button->port_group_ != NO_PORT_GROUP_) {
+            // Buttons that didn't change don't need any more work. The
+            // state comes from the read, since on ESP32 the other core can
+            // have handled the change since.
+            uint8_t group = button->port_group_;
+            if (changed[group] & button->bit_mask_) {
+                MFI_BUTTON_ENTER_CRITICAL();
+                button->input_changed_(
+                    (input[group] & button->bit_mask_) != 0, now);
+                MFI_BUTTON_EXIT_CRITICAL();
+            }
             continue;
         }
-        // Check if the pin has changed state
-        bool state = button->digital_read_();
-        if (state != button->last_state_) {
-            // We always send onPress and onRelease events
-            button->send_press_release_(state);
-            if (state != true) {
-                // Button pressed is pressed when the pin is LOW
-                // If there are long press callbacks, we need to set a timer
-                // to check if the button is still pressed after the shortest
-                // long press time.
-                long_press_t_ *long_press =
-                    SLIST_FIRST(&button->long_press_handlers_);
-                if (long_press != NULL) {
-                    button->set_long_press_timer_(long_press,
-                                                  long_press->duration, now);
-                }
-                button->sequence_clicks_++;
-                button->last_press_time_ = now;
-            } else {
-                // Button released
-                // First we need to deterimine if this was a click or a
-                // long press. If we're in a sequence already, then we
-                // don't allow a switch to long press and do less math.
-                // sequence_clicks_ will be 1 after the start of a long
-                // press, so only a higher value means we're in a sequence.
-                bool is_click = false;
-                if (button->sequence_clicks_ > 1) {
-                    is_click = true;
-                }
-                // Break it out like this to avoid loads & math if possible
-                if (!is_click) {
-                    if (!SLIST_EMPTY(&button->long_press_handlers_)) {
-                        uint16_t press_time = now - button->last_press_time_;
-                        uint16_t shortest_long_press =
-                            SLIST_FIRST(&button->long_press_handlers_)
-                                ->duration;
-                        if (press_time < shortest_long_press) {
-                            is_click = true;
-                        }
-                    } else {
+#endif
+        MFI_BUTTON_ENTER_CRITICAL();
+        button->pin_changed_(now);
+        MFI_BUTTON_EXIT_CRITICAL();
+    }
+}
+
+void MFI_BUTTON_ISR_ATTR MFIButton::poll_buttons_(unsigned long now) {
+    MFIButton::check_buttons_(&polled_buttons_, now);
+    MFI_BUTTON_ENTER_CRITICAL();
+    MFIButton::schedule_poll_(now);
+    MFI_BUTTON_EXIT_CRITICAL();
+}
+
+void MFI_BUTTON_ISR_ATTR MFIButton::schedule_poll_(unsigned long now) {
+    if (MFIButton::poll_timer_ != NULL ||
+        SLIST_EMPTY(&MFIButton::polled_buttons_)) {
+        return;
+    }
+    // Poll quickly while a sequence or long press is being timed, and
+    // slowly while only waiting for the next press.
+    uint16_t interval = MFI_BUTTON_POLL_IDLE_INTERVAL;
+    MFIButton *button;
+    SLIST_FOREACH(button, &polled_buttons_, scanned_entries_) {
+        if (button->busy_(now) || button->sequence_timer_ != NULL) {
+            interval = MFI_BUTTON_POLL_INTERVAL;
+            break;
+        }
+    }
+    timer_t_ *timer = MFIButton::alloc_timer_();
+    if (timer == NULL) {
+        // The timer handler tries again whenever it runs
+        return;
+    }
+    timer->trigger_time = now + MFIButton::ms_to_ticks_(interval);
+    timer->type = TIMER_TYPE_POLL;
+    timer->button = NULL;
+    MFIButton::poll_timer_ = timer;
+    MFIButton::insert_timer_(timer, now);
+}
+
+void MFIButton::check_all_buttons_() {
+    auto now = MFIButton::now_();
+    MFIButton *button;
+    SLIST_FOREACH(button, &started_buttons_, started_entries_) {
+        // This runs from loop(), so the handlers have to be kept out also
+        // where there's no spinlock
+        MFIButton::lock_();
+        button->pin_changed_(now);
+        MFIButton::unlock_();
+    }
+}
+
+bool MFIButton::isIdle() {
+    auto now = MFIButton::now_();
+    bool idle = true;
+    MFI_BUTTON_ENTER_CRITICAL();
+    // The poll timer runs for as long as there are polled buttons, and the
+    // busy check below covers those too.
+    uint8_t timers = MFIButton::poll_timer_ != NULL ? 1 : 0;
+    if (MFIButton::timers_in_use_ != timers || MFIButton::work_requested_) {
+        idle = false;
+    }
+#if MFI_BUTTON_DEFERRED_DISPATCH
+    if (MFIButton::event_queue_head_ != MFIButton::event_queue_tail_) {
+        idle = false;
+    }
+#endif
+    MFIButton *button;
+    SLIST_FOREACH(button, &started_buttons_, started_entries_) {
+        if (!idle) {
+            break;
+        }
+        idle = !button->busy_(now);
+    }
+    MFI_BUTTON_EXIT_CRITICAL();
+    return idle;
+}
+
+bool MFI_BUTTON_ISR_ATTR MFIButton::busy_(unsigned long now) const {
+    // A press has to be followed by a release, and the next edge has to be
+    // outside of the debounce period to be seen.
+    return this->last_state_ != true || this->bouncing_(now);
+}
+
+bool MFI_BUTTON_ISR_ATTR MFIButton::bouncing_(unsigned long now) const {
+    unsigned long debounce =
+        MFIButton::ms_to_ticks_(this->profile_->debounce_time_);
+#if MFI_BUTTON_COMPACT
+    // In 16 bits, a button that was left alone for a multiple of 65 seconds
+    // looks like it just changed. If no button did, this one didn't either.
+    if (now - MFIButton::last_edge_time_ >= debounce) {
+        return false;
+    }
+#endif
+    return MFIButton::since_(this->last_press_time_, now) < debounce ||
+           MFIButton::since_(this->last_release_time_, now) < debounce;
+}
+
+void MFI_BUTTON_ISR_ATTR MFIButton::direct_interrupt_handler_(void *arg) {
+    auto now = MFIButton::now_();
+    MFI_BUTTON_STAT(uint32_t start = MFIButton::stats_clock_());
+    // Only one button can be on this pin, so no need to look further
+    MFI_BUTTON_BATCH_BEGIN();
+    MFI_BUTTON_ENTER_CRITICAL();
+    static_cast<MFIButton *>(arg)->pin_changed_(now);
+    MFI_BUTTON_STAT(MFIButton::add_handler_time_(
+        &MFIButton::stats_.pin_handler, start));
+    MFI_BUTTON_EXIT_CRITICAL();
+    MFI_BUTTON_BATCH_END();
+}
+
+void MFI_BUTTON_ISR_ATTR MFIButton::pin_changed_(unsigned long now) {
+    this->input_changed_(this->digital_read_(), now);
+}
+
+void MFI_BUTTON_ISR_ATTR MFIButton::input_changed_(bool state,
+                                                   unsigned long now) {
+#if MFI_BUTTON_TRACE
+    if (state != this->last_state_) {
+        MFI_BUTTON_TRACE_RECORD(EDGE, this, state, now);
+    }
+#endif
+    // First check if we are in a debounce period
+    if (this->bouncing_(now)) {
+        // Within debounce period, so we just ignore the whole event.
+        // On a press-release-press where only the release is within
+        // the debounce period, we will still get a second press event,
+        // which will be ignored because it won't be a state change.
+#if MFI_BUTTON_STATS
+        if (state != this->last_state_) {
+            this->counters_.edges++;
+            this->counters_.debounced++;
+            MFIButton::stats_.buttons.edges++;
+            MFIButton::stats_.buttons.debounced++;
+        }
+#endif
+#if MFI_BUTTON_TRACE
+        if (state != this->last_state_) {
+            MFI_BUTTON_TRACE_RECORD(DEBOUNCED, this, state, now);
+        }
+#endif
+        return;
+    }
+    // Check if the pin has changed state
+    if (state != this->last_state_) {
+        MFI_BUTTON_STAT(this->counters_.edges++);
+        MFI_BUTTON_STAT(MFIButton::stats_.buttons.edges++);
+        MFI_BUTTON_TRACE_RECORD(STATE, this, state, now);
+        // We always send onPress and onRelease events
+        this->send_press_release_(state);
+        if (state != true) {
+            // Button pressed is pressed when the pin is LOW
+            // A press means the sequence continues, so the timer waiting
+            // for it to end is stale.
+            MFIButton::cancel_timer_(&this->sequence_timer_);
+            // If there are long press callbacks, we need to set a timer
+            // to check if the button is still pressed after the shortest
+            // long press time.
+            if (this->profile_->long_press_count_ != 0 &&
+                !this->long_press_on_release_) {
+                const long_press_t_ *long_press =
+                    &this->profile_->long_presses_[0];
+                this->set_long_press_timer_(long_press, long_press->duration,
+                                            now);
+            }
+            if (this->on_repeat_ != NULL) {
+                this->set_repeat_timer_(now);
+            }
+            this->sequence_clicks_++;
+            this->last_press_time_ = now;
+#if MFI_BUTTON_COMPACT
+            MFIButton::last_edge_time_ = now;
+#endif
+#if MFI_BUTTON_CHORDS
+            if (this->chord_index_ != NO_CHORD_) {
+                MFIButtonChord::pressed_(this, now);
+            }
+#endif
+        } else {
+            // Button released
+            // Any long press or repeat that hasn't fired yet won't happen now
+            MFIButton::cancel_timer_(&this->long_press_timer_);
+            MFIButton::cancel_timer_(&this->repeat_timer_);
+#if MFI_BUTTON_CHORDS
+            if (this->chord_index_ != NO_CHORD_) {
+                MFIButtonChord::released_(this);
+            }
+            if (this->chord_consumed_) {
+                // A chord took the press, which counts as taken below
+                this->chord_consumed_ = false;
+                this->sequence_clicks_ = 0;
+            }
+#endif
+            // First we need to deterimine if this was a click or a
+            // long press. If we're in a sequence already, then we
+            // don't allow a switch to long press and do less math.
+            // sequence_clicks_ will be 1 after the start of a long
+            // press, so only a higher value means we're in a sequence.
+            bool is_click = false;
+            if (this->sequence_clicks_ > 1) {
+                is_click = true;
+            }
+            // Break it out like this to avoid loads & math if possible. A
+            // repeat resets the clicks to 0, the press was taken by it.
+            if (!is_click && this->sequence_clicks_ != 0) {
+                if (this->profile_->long_press_count_ != 0) {
+                    unsigned long press_time =
+                        MFIButton::since_(this->last_press_time_, now);
+                    unsigned long shortest_long_press = MFIButton::ms_to_ticks_(
+                        this->profile_->long_presses_[0].duration);
+                    if (press_time < shortest_long_press) {
                         is_click = true;
                     }
+                } else {
+                    is_click = true;
                 }
-                if (is_click) {
-                    // This was a click
-                    if (button->sequence_clicks_ == button->longest_sequence_) {
-                        // If the number of clicks in the sequence is the same
-                        // as the longest sequence, we send the sequence event
-                        // immediately.
-                        button->send_sequence_(button->sequence_clicks_);
-                    } else {
-                        // If there's still longer sequences, we'll wait for
-                        // the delay, and then check if any more presses have
-                        // happened.
-                        button->add_click_release_timer_(now);
-                    }
+            }
+            if (is_click) {
+                // This was a click
+                if (this->sequence_clicks_ ==
+                    this->profile_->longest_sequence_) {
+                    // If the number of clicks in the sequence is the same
+                    // as the longest sequence, we send the sequence event
+                    // immediately.
+                    this->send_sequence_(this->sequence_clicks_);
                 } else {
-                    // This was a long press, the timer handler should have
-                    // handled it already.
-                    // TODO: Support only firing a single long press event, even
-                    // if multiple long press handlers are registered.
+                    // If there's still longer sequences, we'll wait for
+                    // the delay, and then check if any more presses have
+                    // happened.
+                    this->add_click_release_timer_(now);
                 }
-                button->last_release_time_ = now;
+            } else if (this->long_press_on_release_ &&
+                       this->sequence_clicks_ != 0) {
+                // This was a long press, and now that it's over we know
+                // which one.
+                this->send_long_press_(
+                    this->find_long_press_(
+                        MFIButton::since_(this->last_press_time_, now)));
+                this->sequence_clicks_ = 0;
+            } else {
+                // This was a long press, the timer handler should have
+                // handled it already.
             }
-            button->last_state_ = state;
+            this->last_release_time_ = now;
+#if MFI_BUTTON_COMPACT
+            MFIButton::last_edge_time_ = now;
+#endif
         }
+        this->last_state_ = state;
+#ifdef MFI_BUTTON_HAS_PORT_REGISTERS
+        if (this->port_group_ != NO_PORT_GROUP_) {
+            this->sync_port_group_();
+        }
+#endif
+#if MFI_BUTTON_DEBOUNCE_MASKING
+        // Only buttons with their own interrupt can be masked
+        if (this->pin_ != NO_PIN_ && !this->polled_) {
+            this->start_debounce_(now);
+        }
+#endif
+    }
+}
+
+#if MFI_BUTTON_DEBOUNCE_MASKING
+void MFI_BUTTON_ISR_ATTR MFIButton::start_debounce_(unsigned long now) {
+    if (this->debounce_timer_ != NULL) {
+        return;
+    }
+    timer_t_ *timer = MFIButton::alloc_timer_();
+    if (timer == NULL) {
+        // Without a timer to turn it back on, the interrupt has to stay on.
+        // The software debounce still works, it's just more interrupts.
+        return;
+    }
+    timer->trigger_time =
+        now + MFIButton::ms_to_ticks_(this->profile_->debounce_time_);
+    timer->type = TIMER_TYPE_DEBOUNCE;
+    timer->button = this;
+    this->debounce_timer_ = timer;
+#if MFI_BUTTON_TRACE
+    if (!MFIButton::replaying_)
+#endif
+        this->mask_interrupt_();
+    MFIButton::insert_timer_(timer, now);
+}
+
+void MFI_BUTTON_ISR_ATTR MFIButton::check_debounce_(unsigned long now) {
+    this->debounce_timer_ = NULL;
+    if (!this->started_) {
+        // end() is detaching the interrupt, it mustn't come back
+        return;
+    }
+#if MFI_BUTTON_TRACE
+    // The edges that were missed are in the trace
+    if (MFIButton::replaying_) {
+        return;
     }
+#endif
+    this->unmask_interrupt_();
+    // Any edges during the window were never seen, so sample the pin to
+    // catch up. If it changed, that starts a new debounce window.
+    this->pin_changed_(now);
+}
+
+void MFI_BUTTON_ISR_ATTR MFIButton::mask_interrupt_() {
+#if defined(ESP32)
+    gpio_intr_disable((gpio_num_t)this->pin_);
+#elif defined(ARDUINO_ARCH_RP2040)
+    gpio_set_irq_enabled(this->pin_, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL,
+                         false);
+#else
+    // Detaching on AVR and SAMD only clears the enable bit
+    detachInterrupt(digitalPinToInterrupt(this->pin_));
+#endif
+}
+
+void MFI_BUTTON_ISR_ATTR MFIButton::unmask_interrupt_() {
+    // Edges during the window may have left the interrupt pending, which
+    // costs at most one more interrupt that finds no change.
+#if defined(ESP32)
+    gpio_intr_enable((gpio_num_t)this->pin_);
+#elif defined(ARDUINO_ARCH_RP2040)
+    gpio_acknowledge_irq(this->pin_, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL);
+    gpio_set_irq_enabled(this->pin_, GPIO_IRQ_EDGE_RISE | GPIO_IRQ_EDGE_FALL,
+                         true);
+#else
+    attachInterrupt(digitalPinToInterrupt(this->pin_),
+                    this->interrupt_handler_, CHANGE);
+#endif
 }
+#endif
 
-void MFIButton::timerInterruptHandler() {
+void MFI_BUTTON_ISR_ATTR MFIButton::timerInterruptHandler() {
     // This won't change throughout the handler, so just read
     // it once.
-    auto now = millis();
-    // Iterate through all the timers that have been started
-    timer_t_ *timer, *tmp;
-    TAILQ_FOREACH_SAFE(timer, &MFIButton::timers_, entries, tmp) {
-        // Check if the timer has expired
-        if (now >= timer->trigger_time) {
-            // Timer has expired, so we need to remove it from the list
-            TAILQ_REMOVE(&MFIButton::timers_, timer, entries);
-            // Switch on type
-            switch (timer->type) {
-                case timer_type_t_::TIMER_TYPE_SEQUENCE:
-                    // This was a click release timer, so we need to check if
-                    // there have been any more clicks.
-                    timer->button->check_click_release_(timer);
-                    break;
-                case timer_type_t_::TIMER_TYPE_LONG_PRESS:
-                    // This was a long press timer, so we need to check if
-                    // the button is still pressed.
-                    timer->button->check_long_press_(timer, now);
-                    break;
-            }
-            // Free the timer
-            delete timer;
-        } else {
-            // trigger time is in the future
+    MFI_BUTTON_BATCH_BEGIN();
+    MFIButton::run_timers_(MFIButton::now_());
+    MFI_BUTTON_BATCH_END();
+}
+
+void MFI_BUTTON_ISR_ATTR MFIButton::run_timers_(unsigned long now) {
+    MFI_BUTTON_STAT(uint32_t start = MFIButton::stats_clock_());
+    // Handle all the timers that have expired, earliest first
+    while (true) {
+        MFI_BUTTON_ENTER_CRITICAL();
+        timer_t_ *timer = MFIButton::pop_expired_timer_(now);
+        if (timer == NULL) {
             break;
         }
+        MFI_BUTTON_STAT(MFIButton::stats_.timers_fired++);
+#if MFI_BUTTON_TRACE
+        if (timer->button != NULL) {
+            MFI_BUTTON_TRACE_RECORD(TIMER_FIRE, timer->button, timer->type,
+                                    now);
+        }
+#endif
+        // Not a switch, that can become a jump table, which would be in
+        // flash even when this is in RAM.
+        timer_type_t_ type = (timer_type_t_)timer->type;
+        if (type == timer_type_t_::TIMER_TYPE_SEQUENCE) {
+            // This was a click release timer, so we need to check if
+            // there have been any more clicks.
+            timer->button->check_click_release_(timer);
+        } else if (type == timer_type_t_::TIMER_TYPE_LONG_PRESS) {
+            // This was a long press timer, so we need to check if
+            // the button is still pressed.
+            timer->button->check_long_press_(timer, now);
+        } else if (type == timer_type_t_::TIMER_TYPE_DEBOUNCE) {
+#if MFI_BUTTON_DEBOUNCE_MASKING
+            timer->button->check_debounce_(now);
+#endif
+        } else if (type == timer_type_t_::TIMER_TYPE_SCAN) {
+            MFIButtonScanner *scanner = timer->data.scanner;
+            scanner->scan_timer_ = NULL;
+            scanner->scanning_ = true;
+            scanner->scan_(now);
+            scanner->scanning_ = false;
+        } else if (type == timer_type_t_::TIMER_TYPE_REPEAT) {
+            // Set again in place for the next repeat, rather than returned
+            // to the pool and taken out again.
+            if (timer->button->check_repeat_(timer, now)) {
+                MFI_BUTTON_EXIT_CRITICAL();
+                continue;
+            }
+#if MFI_BUTTON_CHORDS
+        } else if (type == timer_type_t_::TIMER_TYPE_CHORD) {
+            timer->data.chord->held_();
+#endif
+        } else if (type == timer_type_t_::TIMER_TYPE_POLL) {
+            // Polling takes the lock per button, like the pin
+            // interrupt handler, so let go of it first.
+            MFIButton::poll_timer_ = NULL;
+            MFIButton::free_timer_(timer);
+            MFI_BUTTON_EXIT_CRITICAL();
+            MFIButton::poll_buttons_(now);
+            continue;
+        }
+        // Return the timer to the pool
+        MFIButton::free_timer_(timer);
+        // Let go in between timers, so the other core isn't kept waiting
+        MFI_BUTTON_EXIT_CRITICAL();
     }
+    // In case the poll timer couldn't be set for lack of timers
+    MFIButton::schedule_poll_(now);
+    timer_t_ *timer = MFIButton::first_timer_();
     if (timer != NULL) {
         // If there are still timers left, we need to set the next timer
-        MFIButton::set_timer_(timer->trigger_time - now);
+        MFIButton::arm_timer_(timer->trigger_time - now);
     }
+    MFI_BUTTON_STAT(MFIButton::add_handler_time_(
+        &MFIButton::stats_.timer_handler, start));
+    MFI_BUTTON_EXIT_CRITICAL();
 }
 
-void MFIButton::check_click_release_(timer_t_ *timer) {
-    // Check if there have been any more presses since the release for this
-    // event
-    if (this->last_press_time_ > timer->data.release_time) {
-        // There have been more presses, which will have releases, so we
-        // will have new timers already. Do nothing.
-    } else {
-        // There have been no more presses, so we can send the sequence event
-        this->send_sequence_(this->sequence_clicks_);
-    }
+void MFI_BUTTON_ISR_ATTR MFIButton::check_click_release_(timer_t_ *timer) {
+    (void)timer;
+    this->sequence_timer_ = NULL;
+    // Any press after the release would have cancelled this timer, so there
+    // have been no more presses, and we can send the sequence event.
+    this->send_sequence_(this->sequence_clicks_);
 }
 
-void MFIButton::check_long_press_(timer_t_ *timer, unsigned long now) {
-    // Check if the button has been released
-    if (this->last_release_time_ < this->last_press_time_) {
+void MFI_BUTTON_ISR_ATTR MFIButton::check_long_press_(timer_t_ *timer,
+                                                      unsigned long now) {
+    this->long_press_timer_ = NULL;
+    // A release cancels this timer, but check anyway in case the release
+    // was lost in a debounce period.
+    if (this->last_state_ != true) {
         // Button is still pressed, so we need to send the long press event
         this->send_long_press_(timer->data.long_press);
         // Since we're now in a long press, we need to reset the
         // sequence clicks.
         this->sequence_clicks_ = 0;
         // Check if there are any more long press handlers
-        long_press_t_ *next_long_press =
-            SLIST_NEXT(timer->data.long_press, entries);
-        if (next_long_press != NULL) {
+        const MFIButtonProfile *profile = this->profile_;
+        const long_press_t_ *next_long_press = timer->data.long_press + 1;
+        if (next_long_press <
+            profile->long_presses_ + profile->long_press_count_) {
             uint16_t delay =
                 next_long_press->duration - timer->data.long_press->duration;
             this->set_long_press_timer_(next_long_press, delay, now);
@@ -186,83 +1047,773 @@ void MFIButton::check_long_press_(timer_t_ *timer, unsigned long now) {
     // different long press events)
 }
 
-void MFIButton::send_sequence_(uint8_t clicks) {
-    // Iterate through all the sequence handlers
-    sequence_t_ *handler;
-    SLIST_FOREACH(handler, &this->sequence_handlers_, entries) {
-        if (handler->clicks == clicks) {
-            handler->callback(MFIButtonEvent(MFIButtonEvent::SEQUENCE, this,
-                                             (uint16_t)clicks));
-            break;
+MFI_BUTTON_ISR_ATTR const MFIButton::long_press_t_ *
+MFIButton::find_long_press_(unsigned long press_time) const {
+    // Entry low was held for, and none from high on were
+    const long_press_t_ *long_presses = this->profile_->long_presses_;
+    uint8_t low = 0;
+    uint8_t high = this->profile_->long_press_count_;
+    while (high - low > 1) {
+        uint8_t middle = (low + high) / 2;
+        if (MFIButton::ms_to_ticks_(long_presses[middle].duration) <=
+            press_time) {
+            low = middle;
+        } else {
+            high = middle;
         }
     }
-    // reset so we can start a new sequence
+    return &long_presses[low];
+}
+
+void MFI_BUTTON_ISR_ATTR MFIButton::set_repeat_timer_(unsigned long now) {
+    MFIButton::cancel_timer_(&this->repeat_timer_);
+    timer_t_ *timer = MFIButton::alloc_timer_();
+    if (timer == NULL) {
+        return;
+    }
+    timer->trigger_time = now + MFIButton::ms_to_ticks_(this->repeat_delay_);
+    timer->type = TIMER_TYPE_REPEAT;
+    timer->button = this;
+    timer->data.repeat.interval = this->repeat_interval_;
+    timer->data.repeat.count = 0;
+    this->repeat_timer_ = timer;
+    MFIButton::insert_timer_(timer, now);
+}
+
+bool MFI_BUTTON_ISR_ATTR MFIButton::check_repeat_(timer_t_ *timer,
+                                                  unsigned long now) {
+    // Like the long press timer, a release cancels this, but the release
+    // could have been lost in a debounce period.
+    event_callback_t callback = this->on_repeat_;
+    if (this->last_state_ == true || callback == NULL) {
+        this->repeat_timer_ = NULL;
+        return false;
+    }
+    uint16_t count = timer->data.repeat.count + 1;
+    MFIButton::emit_(callback,
+                     MFIButtonEvent(MFIButtonEvent::REPEAT, this, count));
+    // The repeats take over the press, like a long press does
     this->sequence_clicks_ = 0;
+    uint16_t interval = timer->data.repeat.interval;
+    timer->data.repeat.count = count;
+    if (interval > this->repeat_fastest_) {
+        uint16_t step = interval >> 3;
+        interval -= step != 0 ? step : 1;
+        if (interval < this->repeat_fastest_) {
+            interval = this->repeat_fastest_;
+        }
+        timer->data.repeat.interval = interval;
+    }
+    timer->trigger_time = now + MFIButton::ms_to_ticks_(interval);
+    MFIButton::insert_timer_(timer, now);
+    return true;
 }
 
-void MFIButton::send_long_press_(long_press_t_ *long_press) {
-    long_press->callback(
-        MFIButtonEvent(MFIButtonEvent::LONG_PRESS, this, long_press->duration));
+void MFI_BUTTON_ISR_ATTR MFIButton::send_sequence_(uint8_t clicks) {
+    event_callback_t callback = NULL;
+    const MFIButtonProfile *profile = this->profile_;
+    // Read the size first, the table is always published before it
+    if (clicks < profile->sequence_table_size_) {
+        callback = profile->sequence_table_[clicks];
+    } else if (profile->sequence_table_size_ == 0) {
+        // No table, so iterate through all the sequence handlers
+        sequence_t_ *handler;
+        SLIST_FOREACH(handler, &profile->sequence_handlers_, entries) {
+            if (handler->clicks == clicks) {
+                callback = handler->callback;
+                break;
+            }
+        }
+    }
+    if (callback != NULL) {
+        MFIButton::emit_(callback,
+                         MFIButtonEvent(MFIButtonEvent::SEQUENCE, this,
+                                        (uint16_t)clicks));
+    }
+    // reset so we can start a new sequence
+    this->sequence_clicks_ = 0;
 }
 
-void MFIButton::add_click_release_timer_(unsigned long now) {
+void MFI_BUTTON_ISR_ATTR MFIButton::send_long_press_(
+    const long_press_t_ *long_press) {
+    MFIButton::emit_(long_press->callback,
+                     MFIButtonEvent(MFIButtonEvent::LONG_PRESS, this,
+                                    long_press->duration));
+}
 
-    timer_t_ *timer = new timer_t_;
-    timer->trigger_time = now + this->sequence_delay_;
+void MFI_BUTTON_ISR_ATTR MFIButton::add_click_release_timer_(
+    unsigned long now) {
+    MFIButton::cancel_timer_(&this->sequence_timer_);
+    timer_t_ *timer = MFIButton::alloc_timer_();
+    if (timer == NULL) {
+        return;
+    }
+    timer->trigger_time =
+        now + MFIButton::ms_to_ticks_(this->profile_->sequence_delay_);
     timer->type = timer_type_t_::TIMER_TYPE_SEQUENCE;
     timer->button = this;
-    timer->data.release_time = now;
+    this->sequence_timer_ = timer;
     MFIButton::insert_timer_(timer, now);
 }
 
-void MFIButton::set_long_press_timer_(long_press_t_ *long_press, uint16_t delay,
-                                      unsigned long now) {
+void MFI_BUTTON_ISR_ATTR MFIButton::set_long_press_timer_(
+    const long_press_t_ *long_press, uint16_t delay, unsigned long now) {
     // Handlers should be sorted in ascending time order
-    timer_t_ *timer = new timer_t_;
-    timer->trigger_time = now + delay;
+    MFIButton::cancel_timer_(&this->long_press_timer_);
+    timer_t_ *timer = MFIButton::alloc_timer_();
+    if (timer == NULL) {
+        return;
+    }
+    timer->trigger_time = now + MFIButton::ms_to_ticks_(delay);
     timer->type = TIMER_TYPE_LONG_PRESS;
     timer->button = this;
     timer->data.long_press = long_press;
+    this->long_press_timer_ = timer;
     MFIButton::insert_timer_(timer, now);
 }
 
-bool MFIButton::digital_read_() {
+#if MFI_BUTTON_COMPACT
+void MFI_BUTTON_ISR_ATTR MFIButton::timers_insert_before_(timers_head_ *head,
+                                                          timer_t_ *before,
+                                                          timer_t_ *timer) {
+    timer_index_t_ index = timer - MFIButton::timer_pool_;
+    if (before == NULL) {
+        timer->entries.next = NO_TIMER_;
+        timer->entries.prev = head->last;
+        head->last = index;
+    } else {
+        timer->entries.next = before - MFIButton::timer_pool_;
+        timer->entries.prev = before->entries.prev;
+        before->entries.prev = index;
+    }
+    if (timer->entries.prev == NO_TIMER_) {
+        head->first = index;
+    } else {
+        MFIButton::timer_pool_[timer->entries.prev].entries.next = index;
+    }
+}
+
+void MFI_BUTTON_ISR_ATTR MFIButton::timers_remove_(timers_head_ *head,
+                                                   timer_t_ *timer) {
+    timer_links_t_ links = timer->entries;
+    if (links.next == NO_TIMER_) {
+        head->last = links.prev;
+    } else {
+        MFIButton::timer_pool_[links.next].entries.prev = links.prev;
+    }
+    if (links.prev == NO_TIMER_) {
+        head->first = links.next;
+    } else {
+        MFIButton::timer_pool_[links.prev].entries.next = links.next;
+    }
+}
+#endif
+
+void MFIButton::init_timer_pool_() {
+    if (MFIButton::timer_pool_ready_) {
+        return;
+    }
+#if MFI_BUTTON_TIMER_WHEEL
+    for (uint8_t i = 0; i < MFI_BUTTON_TIMER_WHEEL_SLOTS; i++) {
+        MFI_BUTTON_TIMERS_INIT(&MFIButton::wheel_[i]);
+    }
+#endif
+    for (uint8_t i = 0; i < MFI_BUTTON_TIMER_POOL_SIZE; i++) {
+        MFI_BUTTON_TIMERS_INSERT_TAIL(&MFIButton::free_timers_,
+                                      &MFIButton::timer_pool_[i]);
+    }
+    MFIButton::timer_pool_ready_ = true;
+}
+
+MFI_BUTTON_ISR_ATTR MFIButton::timer_t_ *MFIButton::alloc_timer_() {
+    timer_t_ *timer = MFI_BUTTON_TIMERS_FIRST(&MFIButton::free_timers_);
+    if (timer == NULL) {
+        // Nothing we can do in an interrupt handler, except keep count
+        MFIButton::timer_pool_exhausted_++;
+        return NULL;
+    }
+    MFI_BUTTON_TIMERS_REMOVE(&MFIButton::free_timers_, timer);
+    MFIButton::timers_in_use_++;
+#if MFI_BUTTON_STATS
+    if (MFIButton::timers_in_use_ > MFIButton::stats_.timers_max) {
+        MFIButton::stats_.timers_max = MFIButton::timers_in_use_;
+    }
+#endif
+    return timer;
+}
+
+void MFI_BUTTON_ISR_ATTR MFIButton::free_timer_(timer_t_ *timer) {
+    // Most recently used timer goes first, it might still be in cache
+    MFI_BUTTON_TIMERS_INSERT_HEAD(&MFIButton::free_timers_, timer);
+    MFIButton::timers_in_use_--;
+}
+
+#ifdef MFI_BUTTON_HAS_PORT_REGISTERS
+void MFIButton::join_port_group_() {
+    if (this->input_reg_ == NULL) {
+        return;
+    }
+    uint8_t i;
+    for (i = 0; i < MFIButton::port_group_count_; i++) {
+        if (MFIButton::port_groups_[i].reg == this->input_reg_) {
+            break;
+        }
+    }
+    if (i == MFIButton::port_group_count_) {
+        if (i == MFI_BUTTON_PORT_GROUPS) {
+            // No more groups, this button will be read on its own
+            return;
+        }
+        port_group_t_ *group = &MFIButton::port_groups_[i];
+        group->reg = this->input_reg_;
+        group->mask = 0;
+        group->invert = 0;
+        group->state = 0;
+        MFIButton::port_group_count_++;
+    }
+    port_group_t_ *group = &MFIButton::port_groups_[i];
+    if (this->inverted_) {
+        group->invert |= this->bit_mask_;
+    }
+    this->port_group_ = i;
+    this->sync_port_group_();
+    // Set the mask last, the handler ignores the button until then
+    group->mask |= this->bit_mask_;
+}
+
+void MFI_BUTTON_ISR_ATTR MFIButton::sync_port_group_() {
+    port_group_t_ *group = &MFIButton::port_groups_[this->port_group_];
+    if (this->last_state_) {
+        group->state |= this->bit_mask_;
+    } else {
+        group->state &= ~this->bit_mask_;
+    }
+}
+#endif
+
+bool MFI_BUTTON_ISR_ATTR MFIButton::digital_read_() {
     // Normally return true if the pin is HIGH, and false if the pin is LOW
     // when inverted, return true if the pin is LOW, and false if the pin is
     // HIGH
+#ifdef MFI_BUTTON_HAS_PORT_REGISTERS
+    if (this->input_reg_ != NULL) {
+        bool high = (*this->input_reg_ & this->bit_mask_) != 0;
+        return high != this->inverted_;
+    }
+#endif
     int value = digitalRead(this->pin_);
     bool ret = this->inverted_ ? value == LOW : value == HIGH;
     return ret;
 }
 
-void MFIButton::send_press_release_(bool state) {
+void MFI_BUTTON_ISR_ATTR MFIButton::emit_(event_callback_t callback,
+                                          const MFIButtonEvent &event) {
+#if MFI_BUTTON_TRACE
+    // Events always come right after the edge or timer that caused them, so
+    // they get its time, which saves reading the clock.
+    unsigned long time =
+        MFIButton::trace_ring_[(MFIButton::trace_head_ - 1) &
+                          (MFI_BUTTON_TRACE_SIZE - 1)]
+            .time;
+    MFIButton::trace_(MFIButtonTraceRecord::EVENT + event.type_,
+                      event.button_, event.value_, time);
+#endif
+#if MFI_BUTTON_BATCH_EVENTS && \
+    (MFI_BUTTON_DEFERRED_DISPATCH || !defined(MFI_BUTTON_HAS_SPINLOCK))
+    if (MFIButton::batch_depth_ != 0) {
+        if (MFIButton::pending_.count == MFI_BUTTON_BATCH_SIZE) {
+            MFIButton::flush_batch_();
+        }
+        queued_event_t_ *pending =
+            &MFIButton::pending_.events[MFIButton::pending_.count++];
+        pending->callback = callback;
+        pending->event = event;
+#if !MFI_BUTTON_DEFERRED_DISPATCH
+        MFI_BUTTON_STAT(MFIButton::count_event_(event));
+#endif
+        return;
+    }
+#endif
+#if MFI_BUTTON_DEFERRED_DISPATCH
+    queued_event_t_ entry = {callback, event};
+    MFIButton::queue_events_(&entry, 1);
+#elif defined(MFI_BUTTON_HAS_SPINLOCK)
+    // Always called with the lock held, exit_critical_() calls the handler
+    if (MFIButton::pending_.count < sizeof(pending_.events) /
+                                        sizeof(pending_.events[0])) {
+        queued_event_t_ *pending =
+            &MFIButton::pending_.events[MFIButton::pending_.count++];
+        pending->callback = callback;
+        pending->event = event;
+        MFI_BUTTON_STAT(MFIButton::count_event_(event));
+    }
+#else
+    MFI_BUTTON_STAT(MFIButton::count_event_(event));
+#if MFI_BUTTON_BATCH_EVENTS
+    if (MFIButton::on_events_ != NULL) {
+        // Outside of a pass, so a batch of one
+        MFIButton::on_events_(&event, 1);
+        return;
+    }
+#endif
+    callback(event);
+#endif
+}
+
+#if MFI_BUTTON_DEFERRED_DISPATCH
+void MFI_BUTTON_ISR_ATTR MFIButton::queue_events_(
+    const queued_event_t_ *entries, uint8_t count) {
+    uint8_t head = MFIButton::event_queue_head_;
+    uint8_t room = (MFIButton::event_queue_tail_ - head - 1) &
+                   (MFI_BUTTON_EVENT_QUEUE_SIZE - 1);
+    if (count > room) {
+        // Full. Dropping the newest events is the only option that doesn't
+        // involve the consumer.
+        MFIButton::event_queue_overflows_ += count - room;
+        count = room;
+    }
+    if (count == 0) {
+        return;
+    }
+    for (uint8_t i = 0; i < count; i++) {
+        MFIButton::event_queue_[(head + i) &
+                                (MFI_BUTTON_EVENT_QUEUE_SIZE - 1)] =
+            entries[i];
+    }
+    // The entries have to be complete before the consumer can see them
+    __sync_synchronize();
+    MFIButton::event_queue_head_ =
+        (head + count) & (MFI_BUTTON_EVENT_QUEUE_SIZE - 1);
+#if MFI_BUTTON_STATS
+    for (uint8_t i = 0; i < count; i++) {
+        MFIButton::count_event_(entries[i].event);
+    }
+#endif
+    MFIButton::notify_dispatch_();
+}
+#endif
+
+#if MFI_BUTTON_STATS
+void MFI_BUTTON_ISR_ATTR MFIButton::count_event_(const MFIButtonEvent &event) {
+    // Dropped events never get here
+    event.button_->counters_.events[event.type_]++;
+    MFIButton::stats_.buttons.events[event.type_]++;
+}
+
+uint32_t MFI_BUTTON_ISR_ATTR MFIButton::stats_clock_() {
+#if defined(ESP32) || defined(ESP8266)
+    return ESP.getCycleCount();
+#elif defined(MFI_BUTTON_STATS_DWT)
+    return DWT->CYCCNT;
+#else
+    return micros();
+#endif
+}
+
+void MFI_BUTTON_ISR_ATTR MFIButton::add_handler_time_(
+    MFIButtonHandlerStats *stats, uint32_t start) {
+    uint32_t time = MFIButton::stats_clock_() - start;
+    if (stats->calls == 0 || time < stats->min) {
+        stats->min = time;
+    }
+    if (time > stats->max) {
+        stats->max = time;
+    }
+    stats->total += time;
+    stats->calls++;
+}
+
+MFIButtonStats MFIButton::getStats() {
+    MFI_BUTTON_READ_BEGIN();
+    MFIButtonStats stats = MFIButton::stats_;
+    MFI_BUTTON_READ_END();
+    return stats;
+}
+
+MFIButtonCounters MFIButton::getCounters() {
+    MFI_BUTTON_READ_BEGIN();
+    MFIButtonCounters counters = this->counters_;
+    MFI_BUTTON_READ_END();
+    return counters;
+}
+
+void MFIButton::resetStats() {
+    MFI_BUTTON_READ_BEGIN();
+    MFIButton::stats_ = MFIButtonStats();
+    MFI_BUTTON_READ_END();
+}
+
+void MFIButton::resetCounters() {
+    MFI_BUTTON_READ_BEGIN();
+    this->counters_ = MFIButtonCounters();
+    MFI_BUTTON_READ_END();
+}
+#endif
+
+#if MFI_BUTTON_TRACE
+uint16_t MFIButton::readTrace(MFIButtonTraceRecord *records, uint16_t max) {
+    MFI_BUTTON_READ_BEGIN();
+    uint16_t count = MFIButton::trace_wrapped_ ? MFI_BUTTON_TRACE_SIZE
+                                               : MFIButton::trace_head_;
+    if (count > max) {
+        count = max;
+    }
+    // Oldest first, so when it has wrapped that's the next one to be
+    // overwritten. Only the most recent ones fit if max is too small.
+    uint16_t first = (MFIButton::trace_head_ - count) &
+                     (MFI_BUTTON_TRACE_SIZE - 1);
+    for (uint16_t i = 0; i < count; i++) {
+        records[i] =
+            MFIButton::trace_ring_[(first + i) & (MFI_BUTTON_TRACE_SIZE - 1)];
+    }
+    MFI_BUTTON_READ_END();
+    return count;
+}
+
+void MFIButton::printTrace(Print &out) {
+    MFI_BUTTON_READ_BEGIN();
+    uint16_t head = MFIButton::trace_head_;
+    uint16_t count = MFIButton::trace_wrapped_ ? MFI_BUTTON_TRACE_SIZE : head;
+    MFI_BUTTON_READ_END();
+    // One record at a time, so interrupts aren't held off while printing.
+    // Tracing goes on meanwhile, so with a lot going on, the oldest records
+    // may be replaced before they're printed.
+    for (uint16_t i = 0; i < count; i++) {
+        MFI_BUTTON_READ_BEGIN();
+        MFIButtonTraceRecord record =
+            MFIButton::trace_ring_[(head - count + i) &
+                                   (MFI_BUTTON_TRACE_SIZE - 1)];
+        MFI_BUTTON_READ_END();
+        out.print(record.time);
+        out.print(' ');
+        out.print(record.type);
+        out.print(' ');
+        out.print(record.button);
+        out.print(' ');
+        out.println(record.value);
+    }
+}
+
+void MFIButton::clearTrace() {
+    MFI_BUTTON_READ_BEGIN();
+    MFIButton::trace_head_ = 0;
+    MFIButton::trace_wrapped_ = false;
+    MFI_BUTTON_READ_END();
+}
+
+void MFIButton::replayTrace(const MFIButtonTraceRecord *records,
+                            uint16_t count) {
+    MFI_BUTTON_ENTER_CRITICAL();
+    MFIButton::init_timer_pool_();
+    MFIButton::replaying_ = true;
+    // Start from a released button with nothing pending
+    MFIButton::cancel_timer_(&this->sequence_timer_);
+    MFIButton::cancel_timer_(&this->long_press_timer_);
+    MFIButton::cancel_timer_(&this->repeat_timer_);
+#if MFI_BUTTON_DEBOUNCE_MASKING
+    MFIButton::cancel_timer_(&this->debounce_timer_);
+#endif
+    this->last_state_ = true;
+    this->sequence_clicks_ = 0;
+    MFI_BUTTON_EXIT_CRITICAL();
+    bool first = true;
+    for (uint16_t i = 0; i < count; i++) {
+        const MFIButtonTraceRecord *record = &records[i];
+        if (record->button != this->trace_id_) {
+            continue;
+        }
+        unsigned long time = record->time;
+        if (record->type == MFIButtonTraceRecord::TIMER_FIRE) {
+            // Any other timers that were due by then fired as well
+            MFIButton::run_timers_(time);
+        } else if (record->type == MFIButtonTraceRecord::EDGE) {
+            MFI_BUTTON_ENTER_CRITICAL();
+            if (first) {
+                first = false;
+                // Only readings that differ are traced, so the state before
+                // was the opposite. The decision that was taken on it is
+                // in the next record.
+                this->last_state_ = record->value == 0;
+                this->sequence_clicks_ = this->last_state_ ? 0 : 1;
+                unsigned long debounce =
+                    MFIButton::ms_to_ticks_(this->profile_->debounce_time_);
+                bool debounced =
+                    i + 1 < count &&
+                    records[i + 1].type == MFIButtonTraceRecord::DEBOUNCED;
+                unsigned long edge_time = debounced ? time : time - debounce;
+                this->last_press_time_ = edge_time;
+                this->last_release_time_ = edge_time;
+#if MFI_BUTTON_COMPACT
+                MFIButton::last_edge_time_ = edge_time;
+#endif
+            }
+            this->input_changed_(record->value != 0, time);
+            MFI_BUTTON_EXIT_CRITICAL();
+        }
+    }
+    // Whatever is still pending didn't fire before the trace ended
+    MFI_BUTTON_ENTER_CRITICAL();
+    MFIButton::cancel_timer_(&this->sequence_timer_);
+    MFIButton::cancel_timer_(&this->long_press_timer_);
+    MFIButton::cancel_timer_(&this->repeat_timer_);
+#if MFI_BUTTON_DEBOUNCE_MASKING
+    MFIButton::cancel_timer_(&this->debounce_timer_);
+#endif
+    MFIButton::replaying_ = false;
+    MFI_BUTTON_EXIT_CRITICAL();
+}
+#endif
+
+void MFI_BUTTON_ISR_ATTR MFIButton::notify_dispatch_() {
+#ifdef MFI_BUTTON_HAS_FREERTOS
+    TaskHandle_t task = MFIButton::dispatch_task_;
+    if (task != NULL) {
+        BaseType_t woken = pdFALSE;
+        vTaskNotifyGiveFromISR(task, &woken);
+        portYIELD_FROM_ISR(woken);
+    }
+#endif
+}
+
+uint8_t MFIButton::dispatch() {
+    if (MFIButton::work_requested_) {
+        MFIButton::work_requested_ = false;
+        MFIButtonScanner *scanner;
+        SLIST_FOREACH(scanner, &work_scanners_, work_entries_) {
+            if (scanner->work_pending_) {
+                // Clear it first, so a request during work_() isn't lost
+                scanner->work_pending_ = false;
+                // Keys fed by one read go out together, like a scan
+                MFI_BUTTON_BATCH_BEGIN();
+                scanner->work_();
+                MFI_BUTTON_BATCH_END();
+            }
+        }
+    }
+    uint8_t count = 0;
+#if MFI_BUTTON_DEFERRED_DISPATCH
+    uint8_t tail = MFIButton::event_queue_tail_;
+#if MFI_BUTTON_BATCH_EVENTS
+    while (MFIButton::on_events_ != NULL &&
+           tail != MFIButton::event_queue_head_) {
+        // As many as there are, up to a batch, in one call
+        queued_event_t_ entries[MFI_BUTTON_BATCH_SIZE];
+        uint8_t n = 0;
+        uint8_t head = MFIButton::event_queue_head_;
+        __sync_synchronize();
+        while (n < MFI_BUTTON_BATCH_SIZE && tail != head) {
+            entries[n++] = MFIButton::event_queue_[tail];
+            tail = (tail + 1) & (MFI_BUTTON_EVENT_QUEUE_SIZE - 1);
+        }
+        __sync_synchronize();
+        MFIButton::event_queue_tail_ = tail;
+        MFIButton::deliver_(entries, n);
+        count += n;
+    }
+#endif
+    while (tail != MFIButton::event_queue_head_) {
+        // Don't read the entry before we've seen the head move past it
+        __sync_synchronize();
+        // Copy it out, so the slot can be reused before the handler is done
+        queued_event_t_ entry = MFIButton::event_queue_[tail];
+        __sync_synchronize();
+        tail = (tail + 1) & (MFI_BUTTON_EVENT_QUEUE_SIZE - 1);
+        MFIButton::event_queue_tail_ = tail;
+        entry.callback(entry.event);
+        count++;
+    }
+#endif
+    return count;
+}
+
+#ifdef MFI_BUTTON_HAS_FREERTOS
+bool MFIButton::waitForEvents(TickType_t timeout) {
+    if (MFIButton::dispatch_task_ == NULL) {
+        MFIButton::dispatch_task_ = xTaskGetCurrentTaskHandle();
+    }
+    // Notifications are counted, so any event queued since the last call
+    // makes this return right away.
+    while (!MFIButton::work_requested_
+#if MFI_BUTTON_DEFERRED_DISPATCH
+           && MFIButton::event_queue_tail_ == MFIButton::event_queue_head_
+#endif
+    ) {
+        if (ulTaskNotifyTake(pdTRUE, timeout) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void MFIButton::dispatch_task_loop_(void *arg) {
+    (void)arg;
+    MFIButton::dispatch_task_ = xTaskGetCurrentTaskHandle();
+    while (true) {
+        MFIButton::waitForEvents();
+        MFIButton::dispatch();
+    }
+}
+
+bool MFIButton::startDispatchTask(UBaseType_t priority, uint32_t stack_size,
+                                  BaseType_t core) {
+#ifdef ESP32
+    return xTaskCreatePinnedToCore(MFIButton::dispatch_task_loop_,
+                                   "MFIButton", stack_size, NULL, priority,
+                                   NULL, core) == pdPASS;
+#else
+    (void)core;
+    return xTaskCreate(MFIButton::dispatch_task_loop_, "MFIButton",
+                       stack_size, NULL, priority, NULL) == pdPASS;
+#endif
+}
+#endif
+
+void MFI_BUTTON_ISR_ATTR MFIButton::send_press_release_(bool state) {
     if (state != true) {
         // Button pressed
         if (this->on_press_ != NULL) {
-            this->on_press_(MFIButtonEvent(MFIButtonEvent::PRESS, this));
+            MFIButton::emit_(this->on_press_,
+                             MFIButtonEvent(MFIButtonEvent::PRESS, this));
         }
     } else {
         // Button released
         if (this->on_release_ != NULL) {
-            this->on_release_(MFIButtonEvent(MFIButtonEvent::RELEASE, this));
+            MFIButton::emit_(this->on_release_,
+                             MFIButtonEvent(MFIButtonEvent::RELEASE, this));
         }
     }
 }
 
-void MFIButton::insert_timer_(timer_t_ *timer, unsigned long now) {
-    if (TAILQ_EMPTY(&MFIButton::timers_)) {
+#if MFI_BUTTON_TIMER_WHEEL
+uint8_t MFI_BUTTON_ISR_ATTR MFIButton::wheel_slot_(unsigned long time) {
+    return (time >> MFI_BUTTON_TIMER_WHEEL_SHIFT) &
+           (MFI_BUTTON_TIMER_WHEEL_SLOTS - 1);
+}
+
+MFI_BUTTON_ISR_ATTR MFIButton::timer_t_ *MFIButton::wheel_find_first_(
+    unsigned long from) {
+    const unsigned long span = (unsigned long)MFI_BUTTON_TIMER_WHEEL_SLOTS
+                               << MFI_BUTTON_TIMER_WHEEL_SHIFT;
+    // Start of the slot that from is in. Timers up to a full span after
+    // this are on the current lap of the wheel.
+    unsigned long lap_start =
+        from & ~(((unsigned long)1 << MFI_BUTTON_TIMER_WHEEL_SHIFT) - 1);
+    uint8_t start = MFIButton::wheel_slot_(from);
+    // Rotate the used bits so that bit 0 is the slot we're starting at
+    uint32_t used = MFIButton::wheel_used_;
+    if (start != 0) {
+        used = (used >> start) |
+               (used << ((MFI_BUTTON_TIMER_WHEEL_SLOTS - start) & 31));
+    }
+#if MFI_BUTTON_TIMER_WHEEL_SLOTS < 32
+    used &= ((uint32_t)1 << MFI_BUTTON_TIMER_WHEEL_SLOTS) - 1;
+#endif
+    timer_t_ *first = NULL;
+    while (used != 0) {
+        uint8_t offset = __builtin_ctzl(used);
+        used &= used - 1;
+        uint8_t slot = (start + offset) & (MFI_BUTTON_TIMER_WHEEL_SLOTS - 1);
+        timer_t_ *t;
+        timer_t_ *lap_first = NULL;
+        MFI_BUTTON_TIMERS_FOREACH(t, &MFIButton::wheel_[slot]) {
+            // Keep track of the earliest overall, in case every timer turns
+            // out to be on a later lap.
+            if (first == NULL ||
+                MFIButton::before_(t->trigger_time, first->trigger_time)) {
+                first = t;
+            }
+            if (t->trigger_time - lap_start < span &&
+                (lap_first == NULL ||
+                 MFIButton::before_(t->trigger_time,
+                                    lap_first->trigger_time))) {
+                lap_first = t;
+            }
+        }
+        if (lap_first != NULL) {
+            // The first slot with a timer on this lap has the earliest one.
+            return lap_first;
+        }
+    }
+    return first;
+}
+
+void MFI_BUTTON_ISR_ATTR MFIButton::insert_timer_(timer_t_ *timer,
+                                                  unsigned long now) {
+    MFI_BUTTON_STAT(MFIButton::stats_.timers_armed++);
+#if MFI_BUTTON_TRACE
+    if (timer->button != NULL) {
+        MFI_BUTTON_TRACE_RECORD(TIMER_ARM, timer->button, timer->type,
+                                timer->trigger_time);
+    }
+#endif
+    uint8_t slot = MFIButton::wheel_slot_(timer->trigger_time);
+    // Order within a slot doesn't matter, the expiry check looks at all of
+    // them anyway.
+    MFI_BUTTON_TIMERS_INSERT_TAIL(&MFIButton::wheel_[slot], timer);
+    MFIButton::wheel_used_ |= (uint32_t)1 << slot;
+    if (MFIButton::wheel_first_ == NULL ||
+        MFIButton::before_(timer->trigger_time,
+                           MFIButton::wheel_first_->trigger_time)) {
+        MFIButton::wheel_first_ = timer;
+        MFIButton::arm_timer_(timer->trigger_time - now);
+    }
+}
+
+MFI_BUTTON_ISR_ATTR MFIButton::timer_t_ *MFIButton::first_timer_() {
+    return MFIButton::wheel_first_;
+}
+
+MFI_BUTTON_ISR_ATTR MFIButton::timer_t_ *MFIButton::pop_expired_timer_(
+    unsigned long now) {
+    timer_t_ *timer = MFIButton::wheel_first_;
+    if (timer == NULL || MFIButton::before_(now, timer->trigger_time)) {
+        return NULL;
+    }
+    uint8_t slot = MFIButton::wheel_slot_(timer->trigger_time);
+    MFI_BUTTON_TIMERS_REMOVE(&MFIButton::wheel_[slot], timer);
+    if (MFI_BUTTON_TIMERS_EMPTY(&MFIButton::wheel_[slot])) {
+        MFIButton::wheel_used_ &= ~((uint32_t)1 << slot);
+    }
+    // Nothing can be earlier than the timer we just took off, so start
+    // looking from there.
+    MFIButton::wheel_first_ = MFIButton::wheel_find_first_(timer->trigger_time);
+    return timer;
+}
+
+void MFI_BUTTON_ISR_ATTR MFIButton::remove_timer_(timer_t_ *timer) {
+    uint8_t slot = MFIButton::wheel_slot_(timer->trigger_time);
+    MFI_BUTTON_TIMERS_REMOVE(&MFIButton::wheel_[slot], timer);
+    if (MFI_BUTTON_TIMERS_EMPTY(&MFIButton::wheel_[slot])) {
+        MFIButton::wheel_used_ &= ~((uint32_t)1 << slot);
+    }
+    if (timer == MFIButton::wheel_first_) {
+        MFIButton::wheel_first_ =
+            MFIButton::wheel_find_first_(timer->trigger_time);
+    }
+}
+#else
+void MFI_BUTTON_ISR_ATTR MFIButton::insert_timer_(timer_t_ *timer,
+                                                  unsigned long now) {
+    MFI_BUTTON_STAT(MFIButton::stats_.timers_armed++);
+#if MFI_BUTTON_TRACE
+    if (timer->button != NULL) {
+        MFI_BUTTON_TRACE_RECORD(TIMER_ARM, timer->button, timer->type,
+                                timer->trigger_time);
+    }
+#endif
+    if (MFI_BUTTON_TIMERS_EMPTY(&MFIButton::timers_)) {
         // No timers, so just add it to the list
-        TAILQ_INSERT_HEAD(&MFIButton::timers_, timer, entries);
-        MFIButton::set_timer_(timer->trigger_time - now);
+        MFI_BUTTON_TIMERS_INSERT_HEAD(&MFIButton::timers_, timer);
+        MFIButton::arm_timer_(timer->trigger_time - now);
     } else {
         timer_t_ *t;
         // Iterate through the timers to find the right place to insert
-        TAILQ_FOREACH(t, &MFIButton::timers_, entries) {
-            if (timer->trigger_time < t->trigger_time) {
+        MFI_BUTTON_TIMERS_FOREACH(t, &MFIButton::timers_) {
+            if (MFIButton::before_(timer->trigger_time, t->trigger_time)) {
                 // This timer should be inserted before the current timer
-                TAILQ_INSERT_BEFORE(t, timer, entries);
-                if (timer == TAILQ_FIRST(&MFIButton::timers_)) {
-                    MFIButton::set_timer_(timer->trigger_time - now);
+                MFI_BUTTON_TIMERS_INSERT_BEFORE(&MFIButton::timers_, t, timer);
+                if (timer == MFI_BUTTON_TIMERS_FIRST(&MFIButton::timers_)) {
+                    MFIButton::arm_timer_(timer->trigger_time - now);
                 }
                 break;
             }
@@ -271,19 +1822,72 @@ void MFIButton::insert_timer_(timer_t_ *timer, unsigned long now) {
             // This timer should be inserted at the end of the list
             // and since there actually are shorter timers, no need
             // to update the timer interrupt
-            TAILQ_INSERT_TAIL(&MFIButton::timers_, timer, entries);
+            MFI_BUTTON_TIMERS_INSERT_TAIL(&MFIButton::timers_, timer);
         }
     }
 }
 
-void MFIButton::onSequence(uint8_t clicks, event_callback_t callback) {
-    struct sequence_t_ *sequence = new sequence_t_;
+MFI_BUTTON_ISR_ATTR MFIButton::timer_t_ *MFIButton::first_timer_() {
+    return MFI_BUTTON_TIMERS_FIRST(&MFIButton::timers_);
+}
+
+MFI_BUTTON_ISR_ATTR MFIButton::timer_t_ *MFIButton::pop_expired_timer_(
+    unsigned long now) {
+    timer_t_ *timer = MFI_BUTTON_TIMERS_FIRST(&MFIButton::timers_);
+    // The list is sorted, so if the first hasn't expired, none have
+    if (timer == NULL || MFIButton::before_(now, timer->trigger_time)) {
+        return NULL;
+    }
+    MFI_BUTTON_TIMERS_REMOVE(&MFIButton::timers_, timer);
+    return timer;
+}
+
+void MFI_BUTTON_ISR_ATTR MFIButton::remove_timer_(timer_t_ *timer) {
+    MFI_BUTTON_TIMERS_REMOVE(&MFIButton::timers_, timer);
+}
+#endif
+
+void MFI_BUTTON_ISR_ATTR MFIButton::arm_timer_(unsigned long ticks) {
+#if MFI_BUTTON_TRACE
+    if (MFIButton::replaying_) {
+        return;
+    }
+#endif
+    if (MFIButton::set_tick_timer_ != NULL) {
+        MFIButton::set_tick_timer_(ticks);
+        return;
+    }
+    // Round up, so the timer never fires early. More than the callback can
+    // take means it fires early, finds nothing expired and sets the timer
+    // again for the rest.
+    unsigned long ms =
+        (ticks + MFI_BUTTON_TICKS_PER_MS - 1) / MFI_BUTTON_TICKS_PER_MS;
+    MFIButton::set_timer_(ms > 0xFFFF ? 0xFFFF : (uint16_t)ms);
+}
+
+void MFI_BUTTON_ISR_ATTR MFIButton::cancel_timer_(timer_t_ **timer) {
+    if (*timer == NULL) {
+        return;
+    }
+    // If this was the earliest timer, the timer has already been set for
+    // it. There's no way to take that back, but the interrupt handler is fine
+    // with being called when nothing has expired, it just sets the next timer.
+    MFI_BUTTON_STAT(MFIButton::stats_.timers_cancelled++);
+    MFIButton::remove_timer_(*timer);
+    MFIButton::free_timer_(*timer);
+    *timer = NULL;
+}
+
+void MFIButtonProfile::onSequence(uint8_t clicks, event_callback_t callback) {
+    sequence_t_ *sequence = new sequence_t_;
     sequence->clicks = clicks;
     sequence->callback = callback;
     // Insert/replace the sequence in ascending clicks order.
     // SLIST doesn't have _INSERT_BEFORE, so we have to track
     // the previous element.
-    struct sequence_t_ *s, *prev = NULL;
+    sequence_t_ *s, *prev = NULL;
+    bool replaced = false;
+    MFIButton::lock_();
     if (SLIST_EMPTY(&this->sequence_handlers_)) {
         SLIST_INSERT_HEAD(&this->sequence_handlers_, sequence, entries);
     } else {
@@ -299,8 +1903,8 @@ void MFIButton::onSequence(uint8_t clicks, event_callback_t callback) {
             }
             if (clicks == s->clicks) {
                 s->callback = callback;
-                // We don't need the new sequence, so free it
-                delete sequence;
+                // We don't need the new sequence, it's freed below
+                replaced = true;
                 break;
             }
             prev = s;
@@ -318,90 +1922,397 @@ void MFIButton::onSequence(uint8_t clicks, event_callback_t callback) {
     if (this->longest_sequence_ < clicks) {
         this->longest_sequence_ = clicks;
     }
+    MFIButton::unlock_();
+    if (replaced) {
+        delete sequence;
+    }
+    this->build_sequence_table_();
 }
 
-void MFIButton::onSequence(uint8_t clicks, callback_t callback) {
+void MFIButtonProfile::build_sequence_table_() {
+    // Allocating can't be done with the lock held. Registering is only done
+    // from one task at a time, so the size won't change in the meantime.
+    uint8_t size = this->longest_sequence_ + 1;
+    event_callback_t *table = NULL;
+    if (this->longest_sequence_ <= MFI_BUTTON_SEQUENCE_TABLE_MAX) {
+        table = new event_callback_t[size]();
+    }
+    MFIButton::lock_();
+    const event_callback_t *old = this->sequence_table_;
+    if (table == NULL) {
+        // Too sparse to be worth it. Drop the size first, so the interrupt
+        // handlers switch to the list before the table goes away.
+        this->sequence_table_size_ = 0;
+        this->sequence_table_ = NULL;
+    } else {
+        sequence_t_ *handler;
+        SLIST_FOREACH(handler, &this->sequence_handlers_, entries) {
+            table[handler->clicks] = handler->callback;
+        }
+        // Table before size, so the size never covers more than the table
+        this->sequence_table_ = table;
+        this->sequence_table_size_ = size;
+    }
+    MFIButton::unlock_();
+    // The interrupt handlers only look at the table with the lock held, so
+    // nothing can be using the old one now.
+    delete[] old;
+}
+
+void MFIButtonProfile::onSequence(uint8_t clicks, callback_t callback) {
     this->onSequence(clicks, (event_callback_t)callback);
 }
 
-void MFIButton::onClick(event_callback_t callback) {
+void MFIButtonProfile::onClick(event_callback_t callback) {
     this->onSequence(1, callback);
 }
 
-void MFIButton::onClick(callback_t callback) {
+void MFIButtonProfile::onClick(callback_t callback) {
     this->onSequence(1, (event_callback_t)callback);
 }
 
-void MFIButton::onDoubleClick(event_callback_t callback) {
+void MFIButtonProfile::onDoubleClick(event_callback_t callback) {
     this->onSequence(2, callback);
 }
 
-void MFIButton::onDoubleClick(callback_t callback) {
+void MFIButtonProfile::onDoubleClick(callback_t callback) {
     this->onSequence(2, (event_callback_t)callback);
 }
 
-void MFIButton::onLongPress(uint16_t duration, event_callback_t callback) {
-    struct long_press_t_ *long_press = new long_press_t_;
-    long_press->duration = duration;
-    long_press->callback = callback;
-    // Insert the long press in ascending duration order.
-    // SLIST doesn't have _INSERT_BEFORE, so we have to track
-    // the previous element.
-    struct long_press_t_ *l, *prev = NULL;
-    if (SLIST_EMPTY(&this->long_press_handlers_)) {
-        SLIST_INSERT_HEAD(&this->long_press_handlers_, long_press, entries);
-    } else {
-        SLIST_FOREACH(l, &this->long_press_handlers_, entries) {
-            if (duration < l->duration) {
-                if (prev == NULL) {
-                    SLIST_INSERT_HEAD(&this->long_press_handlers_, long_press,
-                                      entries);
-                } else {
-                    SLIST_INSERT_AFTER(prev, long_press, entries);
-                }
-                break;
-            }
-            if (duration == l->duration) {
-                l->callback = callback;
-                // We don't need the new long press, so free it
-                delete long_press;
-                break;
-            }
-            prev = l;
-        }
-        // l will be NULL if we reached the end of the list, and if we reached
-        // the end of the list, that means we haven't inserted.
-        if (l == NULL) {
-            SLIST_INSERT_AFTER(prev, long_press, entries);
+void MFIButtonProfile::onLongPress(uint16_t duration,
+                                   event_callback_t callback) {
+    const long_press_t_ *old = this->long_presses_;
+    uint8_t count = this->long_press_count_;
+    // Replacing a callback is the only change that keeps the size. The array
+    // is only const because MFIStaticButton tables are, and those buttons
+    // don't have onLongPress().
+    for (uint8_t i = 0; i < count; i++) {
+        if (old[i].duration == duration) {
+            MFIButton::lock_();
+            const_cast<long_press_t_ *>(old)[i].callback = callback;
+            MFIButton::unlock_();
+            return;
         }
     }
+    // Make a new array with the long press inserted in ascending duration
+    // order. This is only done during setup, so copying is fine. Only the
+    // registering task changes the array, so it can be read without the lock.
+    long_press_t_ *long_presses = new long_press_t_[count + 1];
+    uint8_t i = 0;
+    for (; i < count && old[i].duration < duration; i++) {
+        long_presses[i] = old[i];
+    }
+    uint8_t inserted = i;
+    long_presses[i].duration = duration;
+    long_presses[i].callback = callback;
+    for (; i < count; i++) {
+        long_presses[i + 1] = old[i];
+    }
+    // Publish the array before the count, so the count never covers more
+    // than the array that is visible.
+    MFIButton::lock_();
+    this->long_presses_ = long_presses;
+    this->long_press_count_ = count + 1;
     // Just like with sequences, we need to make sure the handler
     // is inserted before we up the duration.
     if (longest_long_press_ < duration) {
         longest_long_press_ = duration;
     }
+    // Pending long press timers point into the old array, so move them
+    // over. Any number of buttons can have one, and only the pool knows
+    // them all. Timers in the pool that aren't pending are ignored, since
+    // their button doesn't point back at them.
+    for (uint8_t t = 0; t < MFI_BUTTON_TIMER_POOL_SIZE; t++) {
+        MFIButton::timer_t_ *timer = &MFIButton::timer_pool_[t];
+        if (timer->type != MFIButton::TIMER_TYPE_LONG_PRESS ||
+            timer->button == NULL || timer->button->profile_ != this ||
+            timer->button->long_press_timer_ != timer) {
+            continue;
+        }
+        uint8_t index = timer->data.long_press - old;
+        timer->data.long_press =
+            &long_presses[index < inserted ? index : index + 1];
+    }
+    MFIButton::unlock_();
+    // Nothing else uses the old array outside of the lock
+    delete[] old;
 }
 
-void MFIButton::onLongPress(uint16_t duration, callback_t callback) {
+void MFIButtonProfile::onLongPress(uint16_t duration, callback_t callback) {
     this->onLongPress(duration, (event_callback_t)callback);
 }
 
+void MFIButtonProfile::clear() {
+    MFIButton::lock_();
+    sequence_t_ *handler = SLIST_FIRST(&this->sequence_handlers_);
+    const event_callback_t *table = this->sequence_table_;
+    const long_press_t_ *long_presses = this->long_presses_;
+    SLIST_INIT(&this->sequence_handlers_);
+    this->sequence_table_ = NULL;
+    this->sequence_table_size_ = 0;
+    this->longest_sequence_ = 0;
+    this->long_presses_ = NULL;
+    this->long_press_count_ = 0;
+    this->longest_long_press_ = 0;
+    // Pending long press timers point into the array, see onLongPress()
+    for (uint8_t t = 0; t < MFI_BUTTON_TIMER_POOL_SIZE; t++) {
+        MFIButton::timer_t_ *timer = &MFIButton::timer_pool_[t];
+        if (timer->type == MFIButton::TIMER_TYPE_LONG_PRESS &&
+            timer->button != NULL && timer->button->profile_ == this &&
+            timer->button->long_press_timer_ == timer) {
+            MFIButton::cancel_timer_(&timer->button->long_press_timer_);
+        }
+    }
+    MFIButton::unlock_();
+    // Nothing can get to these anymore
+    while (handler != NULL) {
+        sequence_t_ *next = SLIST_NEXT(handler, entries);
+        delete handler;
+        handler = next;
+    }
+    delete[] table;
+    delete[] long_presses;
+}
+
+MFIButtonProfile *MFIButton::own_profile_() {
+    if (this->owns_profile_) {
+        return this->profile_;
+    }
+    MFIButtonProfile *profile = new MFIButtonProfile();
+    // Keep the timings, only the handlers start from none
+    profile->debounce_time_ = this->profile_->debounce_time_;
+    profile->sequence_delay_ = this->profile_->sequence_delay_;
+    this->setProfile(profile);
+    this->owns_profile_ = true;
+    return profile;
+}
+
+void MFIButton::setProfile(MFIButtonProfile *profile) {
+    if (profile == NULL) {
+        profile = &MFIButton::default_profile_;
+    }
+    MFIButton::lock_();
+    MFIButtonProfile *old = this->owns_profile_ ? this->profile_ : NULL;
+    this->profile_ = profile;
+    this->owns_profile_ = false;
+    // A pending long press points into the old profile, and the press
+    // started out with other handlers anyway.
+    MFIButton::cancel_timer_(&this->long_press_timer_);
+    MFIButton::unlock_();
+    // The interrupt handlers only use the profile with the lock held
+    if (old != NULL) {
+        old->clear();
+        delete old;
+    }
+}
+
+void MFIButton::onSequence(uint8_t clicks, event_callback_t callback) {
+    this->own_profile_()->onSequence(clicks, callback);
+}
+
+void MFIButton::onSequence(uint8_t clicks, callback_t callback) {
+    this->own_profile_()->onSequence(clicks, callback);
+}
+
+void MFIButton::onClick(event_callback_t callback) {
+    this->own_profile_()->onSequence(1, callback);
+}
+
+void MFIButton::onClick(callback_t callback) {
+    this->own_profile_()->onSequence(1, callback);
+}
+
+void MFIButton::onDoubleClick(event_callback_t callback) {
+    this->own_profile_()->onSequence(2, callback);
+}
+
+void MFIButton::onDoubleClick(callback_t callback) {
+    this->own_profile_()->onSequence(2, callback);
+}
+
+void MFIButton::onLongPress(uint16_t duration, event_callback_t callback) {
+    this->own_profile_()->onLongPress(duration, callback);
+}
+
+void MFIButton::onLongPress(uint16_t duration, callback_t callback) {
+    this->own_profile_()->onLongPress(duration, callback);
+}
+
+void MFIButton::setLongPressOnRelease(bool on_release) {
+    MFIButton::lock_();
+    this->long_press_on_release_ = on_release;
+    // A long press that's already on its way would fire twice otherwise
+    MFIButton::cancel_timer_(&this->long_press_timer_);
+    MFIButton::unlock_();
+}
+
+void MFIButton::onRepeat(uint16_t delay, uint16_t interval,
+                         event_callback_t callback, uint16_t fastest) {
+    // A repeat that's due right away again would keep the timer interrupt
+    // handler going forever
+    if (interval == 0) {
+        interval = 1;
+    }
+    if (fastest == 0 || fastest > interval) {
+        fastest = interval;
+    }
+    MFIButton::lock_();
+    this->repeat_delay_ = delay;
+    this->repeat_interval_ = interval;
+    this->repeat_fastest_ = fastest;
+    this->on_repeat_ = callback;
+    MFIButton::unlock_();
+}
+
+void MFIButton::onRepeat(uint16_t delay, uint16_t interval,
+                         callback_t callback, uint16_t fastest) {
+    this->onRepeat(delay, interval, (event_callback_t)callback, fastest);
+}
+
 void MFIButton::onPress(event_callback_t callback) {
+    // A pointer takes more than one store on 8 bit boards
+    MFIButton::lock_();
     this->on_press_ = callback;
+    MFIButton::unlock_();
 }
 
 void MFIButton::onPress(callback_t callback) {
-    this->on_press_ = (event_callback_t)callback;
+    this->onPress((event_callback_t)callback);
 }
 
 void MFIButton::onRelease(event_callback_t callback) {
+    MFIButton::lock_();
     this->on_release_ = callback;
+    MFIButton::unlock_();
 }
 
 void MFIButton::onRelease(callback_t callback) {
-    this->on_release_ = (event_callback_t)callback;
+    this->onRelease((event_callback_t)callback);
 }
 
 void MFIButton::setInterruptTimerCallback(timer_callback_t callback) {
     MFIButton::set_timer_ = callback;
 }
+
+void MFIButton::setInterruptTimerTickCallback(tick_timer_callback_t callback) {
+    MFIButton::set_tick_timer_ = callback;
+}
+
+void MFI_BUTTON_ISR_ATTR MFIButtonScanner::wake_() {
+    auto now = MFIButton::now_();
+    // Not only from interrupt handlers, begin() wakes the scanner too, so
+    // the timer interrupt has to be kept out where there's no spinlock
+    MFI_BUTTON_BATCH_BEGIN();
+    MFIButton::lock_();
+    // The lock is let go of between keys, and a scan from the timer or the
+    // other core may be going on.
+    if (this->scan_timer_ == NULL && !this->scanning_) {
+        this->scanning_ = true;
+        this->scan_(now);
+        this->scanning_ = false;
+    }
+    MFIButton::unlock_();
+    MFI_BUTTON_BATCH_END();
+}
+
+bool MFI_BUTTON_ISR_ATTR MFIButtonScanner::schedule_scan_(uint16_t delay,
+                                                          unsigned long now) {
+    MFIButton::cancel_timer_(&this->scan_timer_);
+    MFIButton::timer_t_ *timer = MFIButton::alloc_timer_();
+    if (timer == NULL) {
+        return false;
+    }
+    timer->trigger_time = now + MFIButton::ms_to_ticks_(delay);
+    timer->type = MFIButton::TIMER_TYPE_SCAN;
+    timer->button = NULL;
+    timer->data.scanner = this;
+    this->scan_timer_ = timer;
+    MFIButton::insert_timer_(timer, now);
+    return true;
+}
+
+MFIButton *MFIButtonScanner::make_keys_(uint8_t count) {
+    return new MFIButton[count];
+}
+
+#ifndef MFI_BUTTON_HAS_SPINLOCK
+// Handlers can change settings while a scanner holds the lock, so it can be
+// nested. Only the outermost lock saves the interrupt state, and nothing
+// else can take it while interrupts are off.
+static uint8_t mfi_lock_depth = 0;
+#if defined(__AVR__) || defined(ARDUINO_ARCH_RP2040) || defined(__arm__)
+static uint32_t mfi_saved_interrupts;
+#endif
+#endif
+
+void MFI_BUTTON_ISR_ATTR MFIButton::lock_() {
+#ifdef MFI_BUTTON_HAS_SPINLOCK
+    MFI_BUTTON_ENTER_CRITICAL();
+#else
+    // The interrupt handlers must not run in the middle of this. It can be
+    // called from an interrupt handler too, so interrupts go back to how
+    // they were.
+#if defined(__AVR__)
+    uint8_t saved = SREG;
+    cli();
+#elif defined(ARDUINO_ARCH_RP2040)
+    uint32_t saved = save_and_disable_interrupts();
+#elif defined(__arm__)
+    uint32_t saved = __get_PRIMASK();
+    __disable_irq();
+#else
+    noInterrupts();
+#endif
+    if (mfi_lock_depth++ != 0) {
+        return;
+    }
+#if defined(__AVR__) || defined(ARDUINO_ARCH_RP2040) || defined(__arm__)
+    mfi_saved_interrupts = saved;
+#endif
+#endif
+}
+
+void MFI_BUTTON_ISR_ATTR MFIButton::unlock_() {
+#ifdef MFI_BUTTON_HAS_SPINLOCK
+    MFI_BUTTON_EXIT_CRITICAL();
+#else
+    if (--mfi_lock_depth != 0) {
+        return;
+    }
+#if defined(__AVR__)
+    SREG = mfi_saved_interrupts;
+#elif defined(ARDUINO_ARCH_RP2040)
+    restore_interrupts(mfi_saved_interrupts);
+#elif defined(__arm__)
+    __set_PRIMASK(mfi_saved_interrupts);
+#else
+    interrupts();
+#endif
+#endif
+}
+
+void MFI_BUTTON_ISR_ATTR MFIButtonScanner::lock_() {
+    // Keys are also fed from dispatch()
+    MFIButton::lock_();
+}
+
+void MFI_BUTTON_ISR_ATTR MFIButtonScanner::unlock_() {
+    MFIButton::unlock_();
+}
+
+void MFIButtonScanner::enable_work_() {
+    if (this->work_enabled_) {
+        return;
+    }
+    this->work_enabled_ = true;
+    MFI_BUTTON_ENTER_CRITICAL();
+    SLIST_INSERT_HEAD(&MFIButton::work_scanners_, this, work_entries_);
+    MFI_BUTTON_EXIT_CRITICAL();
+}
+
+void MFI_BUTTON_ISR_ATTR MFIButtonScanner::request_work_() {
+    // Flag before the global, dispatch() clears the global first
+    this->work_pending_ = true;
+    MFIButton::work_requested_ = true;
+    MFIButton::notify_dispatch_();
+}
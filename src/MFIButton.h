@@ -4,10 +4,317 @@
 #include "Arduino.h"
 #include "bsd/queue.h"
 
+#if defined(ARDUINO_ARCH_RP2040)
+#include "hardware/gpio.h"
+#include "hardware/sync.h"
+#include "hardware/structs/sio.h"
+#endif
+#if defined(ESP32)
+#include "driver/gpio.h"
+#include "esp_timer.h"
+#endif
+
 #define MFI_BUTTON_DEFAULT_DEBOUNCE 35
 #define MFI_BUTTON_DEFAULT_SEQUENCE_DELAY 250
 
+// Everything the pin and timer interrupt handlers run, down to the timer
+// queue, the debounce code and the built-in timer, is placed in RAM: IRAM on
+// ESP32 and ESP8266, and SRAM on RP2040. On ESP32 that means the handlers
+// keep working while the flash cache is off for a flash write, provided the
+// interrupts are allocated as IRAM interrupts (CONFIG_ARDUINO_ISR_IRAM). On
+// RP2040 it saves the XIP cache misses. ESP8266 requires it for anything that
+// attachInterrupt() calls. Set to 0 to keep it all in flash and save the RAM.
+//
+// What is cache safe is the library's own code and data, with two exceptions:
+// the callbacks it calls and MFIButtonScanner subclasses, which call into the
+// Arduino core. The timer callback, and every event handler that runs from an
+// interrupt, has to be in IRAM as well, for example declared with IRAM_ATTR.
+// With MFI_BUTTON_DEFERRED_DISPATCH only the timer callback does, the event
+// handlers then run from dispatch().
+#ifndef MFI_BUTTON_ISR_IN_RAM
+#if defined(ESP32) || defined(ESP8266) || defined(ARDUINO_ARCH_RP2040)
+#define MFI_BUTTON_ISR_IN_RAM 1
+#else
+#define MFI_BUTTON_ISR_IN_RAM 0
+#endif
+#endif
+#if MFI_BUTTON_ISR_IN_RAM && (defined(ESP32) || defined(ESP8266))
+#define MFI_BUTTON_ISR_ATTR IRAM_ATTR
+#elif MFI_BUTTON_ISR_IN_RAM && defined(ARDUINO_ARCH_RP2040)
+// The sections the SDK's __not_in_flash_func() uses, copied to RAM at boot
+#define MFI_BUTTON_ISR_ATTR __attribute__((section(".time_critical.mfibutton")))
+#else
+#define MFI_BUTTON_ISR_ATTR
+#endif
+
+// All timing is done in ticks of MFI_BUTTON_TICKS(), which is millis() by
+// default. Define MFI_BUTTON_USE_MICROS to run on micros() instead, or define
+// both MFI_BUTTON_TICKS() and MFI_BUTTON_TICKS_PER_MS for another 32-bit
+// tick source. Durations in the API are always in milliseconds. Time math is
+// done on differences, so it's fine when the tick counter wraps.
+#ifndef MFI_BUTTON_TICKS
+#if MFI_BUTTON_ISR_IN_RAM && defined(ESP32)
+// The same as millis() and micros(), but esp_timer_get_time() is in IRAM
+#ifdef MFI_BUTTON_USE_MICROS
+#define MFI_BUTTON_TICKS() ((unsigned long)esp_timer_get_time())
+#define MFI_BUTTON_TICKS_PER_MS 1000
+#else
+#define MFI_BUTTON_TICKS() ((unsigned long)(esp_timer_get_time() / 1000))
+#define MFI_BUTTON_TICKS_PER_MS 1
+#endif
+#elif defined(MFI_BUTTON_USE_MICROS)
+#define MFI_BUTTON_TICKS() micros()
+#define MFI_BUTTON_TICKS_PER_MS 1000
+#else
+#define MFI_BUTTON_TICKS() millis()
+#define MFI_BUTTON_TICKS_PER_MS 1
+#endif
+#endif
+
+// Set to 1 to have begin() set up a hardware timer when no timer callback has
+// been set: esp_timer on ESP32, Timer1 (or Timer2 with
+// MFI_BUTTON_AVR_TIMER 2) compare match on AVR, a hardware alarm on RP2040,
+// and TC3 on SAMD21. The timer is then no longer available to other code.
+#ifndef MFI_BUTTON_BUILTIN_TIMER
+#define MFI_BUTTON_BUILTIN_TIMER 0
+#endif
+
+// Timers are taken from a fixed size pool, so that nothing is allocated in
+// interrupt context. A button has at most one timer of each type pending
+// (long press, sequence, and debounce if masking is on), so the default
+// covers 5 to 8 buttons being busy at once.
+#ifndef MFI_BUTTON_TIMER_POOL_SIZE
+#define MFI_BUTTON_TIMER_POOL_SIZE 16
+#endif
+// Timers are counted and indexed in 8 bits
+#if MFI_BUTTON_TIMER_POOL_SIZE < 1 || MFI_BUTTON_TIMER_POOL_SIZE > 255
+#error "MFI_BUTTON_TIMER_POOL_SIZE must be from 1 to 255"
+#endif
+
+// Set to 1 for a smaller MFIButton and timer, for AVR boards with 2KB of RAM.
+// Flags are packed into bits, press and release times are kept in 16 bits,
+// and the links of the timer queue are indexes into the pool instead of
+// pointers. Presses are then only timed up to 65 seconds, and the pool can
+// have at most 255 timers. sizeof(MFIButton) and MFIButton::timerSize()
+// give what each button and each timer in the pool take.
+#ifndef MFI_BUTTON_COMPACT
+#define MFI_BUTTON_COMPACT 0
+#endif
+#if MFI_BUTTON_COMPACT
+#if MFI_BUTTON_TICKS_PER_MS != 1
+#error "MFI_BUTTON_COMPACT needs MFI_BUTTON_TICKS() to count milliseconds"
+#endif
+// A flag takes a single bit
+#define MFI_BUTTON_FLAG_BITS : 1
+#else
+#define MFI_BUTTON_FLAG_BITS
+#endif
+
+// By default pending timers are kept in a list sorted by trigger time, which
+// is the cheapest option for a few buttons. With many buttons the sorted
+// insert gets expensive, so the timer wheel hashes timers into buckets of
+// 2^MFI_BUTTON_TIMER_WHEEL_SHIFT ticks instead, giving constant time
+// inserts and expiry. Timers further out than the wheel spans simply wait for
+// the wheel to come around again.
+#ifndef MFI_BUTTON_TIMER_WHEEL
+#define MFI_BUTTON_TIMER_WHEEL 0
+#endif
+
+// With deferred dispatch the interrupt handlers don't call the event handlers
+// themselves. Events are put in a queue of MFI_BUTTON_EVENT_QUEUE_SIZE
+// entries instead, and MFIButton::dispatch() calls the handlers from normal
+// code, typically loop() or a task.
+#ifndef MFI_BUTTON_DEFERRED_DISPATCH
+#define MFI_BUTTON_DEFERRED_DISPATCH 0
+#endif
+#if MFI_BUTTON_DEFERRED_DISPATCH
+#ifndef MFI_BUTTON_EVENT_QUEUE_SIZE
+#define MFI_BUTTON_EVENT_QUEUE_SIZE 16
+#endif
+#if MFI_BUTTON_EVENT_QUEUE_SIZE > 256 || \
+    (MFI_BUTTON_EVENT_QUEUE_SIZE & (MFI_BUTTON_EVENT_QUEUE_SIZE - 1)) != 0
+#error "MFI_BUTTON_EVENT_QUEUE_SIZE must be a power of 2, at most 256"
+#endif
+#endif
+
+// Set to 1 to collect the events of each pass of the pin and timer interrupt
+// handlers, and hand them over together when it ends, see
+// MFIButton::onEvents(). With deferred dispatch, a batch goes into the queue
+// with a single update of the head. A batch has room for
+// MFI_BUTTON_BATCH_SIZE events, a full one is handed over right away.
+#ifndef MFI_BUTTON_BATCH_EVENTS
+#define MFI_BUTTON_BATCH_EVENTS 0
+#endif
+#if MFI_BUTTON_BATCH_EVENTS
+#ifndef MFI_BUTTON_BATCH_SIZE
+#define MFI_BUTTON_BATCH_SIZE 8
+#endif
+#if MFI_BUTTON_BATCH_SIZE < 4 || MFI_BUTTON_BATCH_SIZE > 255
+#error "MFI_BUTTON_BATCH_SIZE must be from 4 to 255"
+#endif
+#endif
+// Where the core tells us which input register and bit a pin is on, pins are
+// read straight from the register instead of through digitalRead(). Buttons
+// that share the pin interrupt handler are also grouped by register, so that
+// one read per register finds every button that changed. Buttons on more
+// than MFI_BUTTON_PORT_GROUPS different registers are read one at a time.
+#if defined(ARDUINO_ARCH_RP2040) ||                              \
+    (defined(portInputRegister) && defined(digitalPinToPort) && \
+     defined(digitalPinToBitMask))
+#define MFI_BUTTON_HAS_PORT_REGISTERS
+#endif
+#ifndef MFI_BUTTON_PORT_GROUPS
+#define MFI_BUTTON_PORT_GROUPS 4
+#endif
+
+// With debounce masking, the first edge of a bounce turns off the pin's
+// interrupt, and a timer turns it back on after the debounce time and samples
+// the pin. The software debounce still ignores edges inside the window, but
+// they don't even cost an interrupt this way, so a press is about two pin
+// interrupts no matter how bad the switch is.
+#ifndef MFI_BUTTON_DEBOUNCE_MASKING
+#define MFI_BUTTON_DEBOUNCE_MASKING 0
+#endif
+// Chips with GPIO glitch filters get them turned on for every button. These
+// only filter out pulses of a few clock cycles, so they help with noise,
+// not with switch bounce.
+#ifndef MFI_BUTTON_GLITCH_FILTER
+#if defined(ESP32) && defined(SOC_GPIO_SUPPORT_PIN_GLITCH_FILTER) && \
+    __has_include("driver/gpio_filter.h")
+#define MFI_BUTTON_GLITCH_FILTER 1
+#else
+#define MFI_BUTTON_GLITCH_FILTER 0
+#endif
+#endif
+#if MFI_BUTTON_GLITCH_FILTER
+#include "driver/gpio_filter.h"
+#endif
+
+// onSequence() keeps a table of callbacks indexed by number of clicks, so
+// that finding the handler is a single load. For buttons with handlers for
+// more clicks than this, the table would be mostly empty, so the list of
+// handlers is searched instead.
+#ifndef MFI_BUTTON_SEQUENCE_TABLE_MAX
+#define MFI_BUTTON_SEQUENCE_TABLE_MAX 16
+#endif
+
+// On ESP32 the pin and timer interrupts can run on both cores at once, and
+// handlers can be registered from a task while they run, so all button and
+// timer state is guarded by a spinlock. It is only held while the state is
+// updated; the event handlers are called after it's released.
+#if defined(ESP32)
+#define MFI_BUTTON_HAS_SPINLOCK
+#endif
+// Set to a core number to attach the pin interrupts on that core, and to
+// start the dispatch task there by default. ESP32 runs a GPIO interrupt on
+// the core that allocated it, which is the core of the first attachInterrupt()
+// call by any code. The timer interrupt runs wherever the timer callback's
+// timer does.
+#ifndef MFI_BUTTON_CORE
+#define MFI_BUTTON_CORE -1
+#endif
+
+// Set to 1 for MFIButton::sleep(). On AVR this defines the pin change
+// interrupt vectors, so it can't be used together with other code that
+// defines them, like SoftwareSerial.
+#ifndef MFI_BUTTON_SLEEP
+#define MFI_BUTTON_SLEEP 0
+#endif
+#if MFI_BUTTON_SLEEP && !defined(ESP32) && !defined(__AVR__)
+#error "MFI_BUTTON_SLEEP is only supported on ESP32 and AVR"
+#endif
+
+// On FreeRTOS the dispatching task can sleep until there are events
+#ifdef INC_FREERTOS_H
+#define MFI_BUTTON_HAS_FREERTOS
+#endif
+#if MFI_BUTTON_TIMER_WHEEL
+#ifndef MFI_BUTTON_TIMER_WHEEL_SLOTS
+#define MFI_BUTTON_TIMER_WHEEL_SLOTS 32
+#endif
+#ifndef MFI_BUTTON_TIMER_WHEEL_SHIFT
+// About 32ms per slot
+#if MFI_BUTTON_TICKS_PER_MS >= 1000
+#define MFI_BUTTON_TIMER_WHEEL_SHIFT 15
+#else
+#define MFI_BUTTON_TIMER_WHEEL_SHIFT 5
+#endif
+#endif
+#if MFI_BUTTON_TIMER_WHEEL_SLOTS > 32 || \
+    (MFI_BUTTON_TIMER_WHEEL_SLOTS & (MFI_BUTTON_TIMER_WHEEL_SLOTS - 1)) != 0
+#error "MFI_BUTTON_TIMER_WHEEL_SLOTS must be a power of 2, at most 32"
+#endif
+#endif
+
+// Direct dispatch attaches a separate interrupt handler to each pin, which
+// goes straight to the button that owns it, instead of one shared handler
+// that has to check every started button. Set to 0 to always use the shared
+// handler.
+#ifndef MFI_BUTTON_DIRECT_DISPATCH
+#define MFI_BUTTON_DIRECT_DISPATCH 1
+#endif
+// Cores that can pass an argument to an interrupt handler can dispatch
+// directly with no extra memory. The rest use a table with one slot per
+// interrupt number, and buttons on interrupts beyond the table fall back to
+// the shared handler.
+#if defined(ESP32) || defined(ESP8266)
+#define MFI_BUTTON_HAS_INTERRUPT_ARG
+#endif
+#ifndef MFI_BUTTON_DISPATCH_SLOTS
+#if defined(ARDUINO_ARCH_RP2040)
+#define MFI_BUTTON_DISPATCH_SLOTS 30
+#else
+#define MFI_BUTTON_DISPATCH_SLOTS 8
+#endif
+#endif
+
+// Buttons on pins without an interrupt are polled instead, all at once from a
+// single timer. That runs every MFI_BUTTON_POLL_INTERVAL ms while any of them
+// is pressed, bouncing or in a sequence, and every
+// MFI_BUTTON_POLL_IDLE_INTERVAL ms otherwise, so a press can take up to that
+// long to be seen.
+#ifndef MFI_BUTTON_POLL_INTERVAL
+#define MFI_BUTTON_POLL_INTERVAL 5
+#endif
+#ifndef MFI_BUTTON_POLL_IDLE_INTERVAL
+#define MFI_BUTTON_POLL_IDLE_INTERVAL 25
+#endif
+
+// Set to 1 for MFIButtonChord, which sees presses of several buttons
+// together. It adds a few bytes to every button.
+#ifndef MFI_BUTTON_CHORDS
+#define MFI_BUTTON_CHORDS 0
+#endif
+
+// Set to 1 to keep counts of what the interrupt handlers do, and how long
+// they take, see MFIButton::getStats(). Handler times are in CPU cycles on
+// ESP32, ESP8266 and Cortex-M3 and up, and in microseconds elsewhere.
+#ifndef MFI_BUTTON_STATS
+#define MFI_BUTTON_STATS 0
+#endif
+
+// Set to 1 to record what the state machine does in a ring of
+// MFI_BUTTON_TRACE_SIZE records, 8 bytes each. See MFIButton::readTrace() and
+// MFIButton::replayTrace().
+#ifndef MFI_BUTTON_TRACE
+#define MFI_BUTTON_TRACE 0
+#endif
+#if MFI_BUTTON_TRACE
+#ifndef MFI_BUTTON_TRACE_SIZE
+#define MFI_BUTTON_TRACE_SIZE 32
+#endif
+#if MFI_BUTTON_TRACE_SIZE > 32768 || \
+    (MFI_BUTTON_TRACE_SIZE & (MFI_BUTTON_TRACE_SIZE - 1)) != 0
+#error "MFI_BUTTON_TRACE_SIZE must be a power of 2, at most 32768"
+#endif
+#endif
+
 class MFIButton;
+class MFIButtonScanner;
+class MFIButtonChord;
+class MFIButtonProfile;
+template <uint8_t pin, bool pullup, bool inverted, typename... handlers>
+class MFIStaticButton;
 
 class MFIButtonEvent {
    public:
@@ -17,31 +324,135 @@ class MFIButtonEvent {
         CLICK,
         LONG_PRESS,
         SEQUENCE,
+        // value is the number of the repeat, starting at 1
+        REPEAT,
+        // From MFIButtonChord, for the button that completed it. value is
+        // the hold time for buttons held together, 0 for hold and click.
+        CHORD,
+        // From MFIEncoder, for its switch button. value is the detents
+        // turned, see steps().
+        TURN,
     };
     MFIButtonEvent(Type type, MFIButton *button, uint16_t value = 0)
         : type_(type), value_(value), button_(button){};
     Type type() const { return this->type_; }
     uint16_t value() const { return this->value_; }
+    // value() as a signed number, for TURN, positive when A leads B
+    int16_t steps() const { return (int16_t)this->value_; }
+    // The button it happened to, so one handler can serve many buttons
+    MFIButton *button() const { return this->button_; }
+    // The button's context, see MFIButton::setContext()
+    void *context() const;
 
    protected:
+    friend class MFIButton;
+    // Only for the deferred dispatch queue
+    MFIButtonEvent(){};
     Type type_;
     uint16_t value_;
     MFIButton *button_;
 };
 
+#if MFI_BUTTON_TRACE
+struct MFIButtonTraceRecord {
+    enum Type : uint8_t {
+        // A reading that differed from the last state, value is the reading
+        EDGE,
+        // The edge was within the debounce time, value is the reading
+        DEBOUNCED,
+        // The edge was taken, value is the new state
+        STATE,
+        // A timer was queued, time is when it's due and value its type
+        TIMER_ARM,
+        // A timer of the type in value fired
+        TIMER_FIRE,
+        // An event was emitted, the type is EVENT + MFIButtonEvent::Type,
+        // and value is MFIButtonEvent::value()
+        EVENT,
+    };
+    // In ticks of MFI_BUTTON_TICKS()
+    uint32_t time;
+    uint8_t type;
+    // MFIButton::getTraceId() of the button
+    uint8_t button;
+    uint16_t value;
+};
+#endif
+
+#if MFI_BUTTON_STATS
+// Kept for every button, and summed over all of them
+struct MFIButtonCounters {
+    // Readings that differed from the last state, so usually pin edges
+    uint32_t edges;
+    // Of those, the ones ignored for being within the debounce time
+    uint32_t debounced;
+    // Events delivered, indexed by MFIButtonEvent::Type
+    uint32_t events[MFIButtonEvent::TURN + 1];
+};
+
+struct MFIButtonHandlerStats {
+    uint32_t calls;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+    uint32_t average() const { return calls == 0 ? 0 : total / calls; }
+};
+
+struct MFIButtonStats {
+    MFIButtonCounters buttons;
+    // Timers put in the queue, taken out before they fired, and fired
+    uint32_t timers_armed;
+    uint32_t timers_cancelled;
+    uint32_t timers_fired;
+    // Most timers in use at once, out of MFI_BUTTON_TIMER_POOL_SIZE
+    uint8_t timers_max;
+    // The pin interrupt handlers, shared and direct, and the timer handler
+    MFIButtonHandlerStats pin_handler;
+    MFIButtonHandlerStats timer_handler;
+};
+#endif
+
 class MFIButton {
    public:
     typedef void (*callback_t)();
     typedef void (*event_callback_t)(MFIButtonEvent);
     typedef void (*timer_callback_t)(uint16_t);
+    typedef void (*tick_timer_callback_t)(unsigned long);
+#if MFI_BUTTON_BATCH_EVENTS
+    typedef void (*events_callback_t)(const MFIButtonEvent *events,
+                                      size_t count);
+#endif
 
     // Constructor
     MFIButton(int pin, bool pullup = true, bool inverted = false)
-        : pin_(pin), pullup_(pullup), inverted_(inverted){};
+        : inverted_(inverted),
+          pullup_(pullup),
+          polled_(false),
+          long_press_on_release_(false),
+          owns_profile_(false),
+          started_(false),
+          last_state_(false),
+#if MFI_BUTTON_CHORDS
+          chord_consumed_(false),
+#endif
+          pin_(pin){};
     // Methods
+    // The callback gets the time until the next timer in milliseconds,
+    // rounded up.
     static void setInterruptTimerCallback(timer_callback_t callback);
+    // Same, but the callback gets ticks of MFI_BUTTON_TICKS(), so there is
+    // nothing to convert when the hardware timer runs at the same rate.
+    static void setInterruptTimerTickCallback(tick_timer_callback_t callback);
+#if MFI_BUTTON_BUILTIN_TIMER
+    // Sets up the built-in hardware timer. Called by begin() if there's no
+    // timer callback, so only needed to get the timer set up earlier.
+    static bool useBuiltinTimer();
+#endif
     // the callback_t overloads are for convenience, so that event
-    // handlers don't need to declare a parameter
+    // handlers don't need to declare a parameter. Handlers can be set at any
+    // time, also after begin() and from other handlers, and an
+    // event_callback_t of NULL removes one. To change many at once, see
+    // setProfile().
     void onPress(event_callback_t callback);
     void onPress(callback_t callback);
     void onRelease(event_callback_t callback);
@@ -54,18 +465,162 @@ class MFIButton {
     void onDoubleClick(callback_t callback);
     void onLongPress(uint16_t duration, event_callback_t callback);
     void onLongPress(uint16_t duration, callback_t callback);
+    // Normally every long press handler fires in turn while the button is
+    // held. On release, only the longest one that the button was held for
+    // fires, once it's let go, and no timers are used for it.
+    void setLongPressOnRelease(bool on_release);
+    // Repeats for as long as the button is held, the first time after delay
+    // ms and then every interval ms. With fastest set below interval, each
+    // repeat comes an eighth sooner than the one before, down to fastest.
+    // A press that repeated is not a click. There is one repeat handler per
+    // button, and a single timer that is set again for every repeat. An
+    // interval of 0 is taken as 1.
+    void onRepeat(uint16_t delay, uint16_t interval, event_callback_t callback,
+                  uint16_t fastest = 0);
+    void onRepeat(uint16_t delay, uint16_t interval, callback_t callback,
+                  uint16_t fastest = 0);
     static void timerInterruptHandler();
+    // Pins without an interrupt are polled, see MFI_BUTTON_POLL_INTERVAL
     bool begin();
+    // Detaches the interrupt and drops the pending timers, so the button is
+    // left alone until the next begin(). A press that's going on is not
+    // finished, so no release or click is sent for it. Events that were
+    // already queued for dispatch() are still delivered.
+    void end();
+    // Number of times a timer was needed while the pool was empty. Each of
+    // those means a sequence or long press event was lost, so if this is not
+    // 0, MFI_BUTTON_TIMER_POOL_SIZE needs to go up.
+    static uint16_t getTimerPoolExhaustedCount() {
+        return timer_pool_exhausted_;
+    };
+    // Bytes each timer in the pool takes
+    static constexpr size_t timerSize() { return sizeof(timer_t_); };
+    // True when no button is pressed or bouncing, no timers other than the
+    // poll timer are pending and nothing is waiting for dispatch(), so nothing
+    // is lost by sleeping until the next press.
+    static bool isIdle();
+#if MFI_BUTTON_STATS
+    // These copy the counters with the interrupt handlers held off, which
+    // only takes as long as the copy.
+    static MFIButtonStats getStats();
+    MFIButtonCounters getCounters();
+    // The global stats and the button counters are reset separately
+    static void resetStats();
+    void resetCounters();
+#endif
+#if MFI_BUTTON_TRACE
+    // Copies the trace to records, oldest first, and returns how many there
+    // were. Interrupts are held off for the length of the copy.
+    static uint16_t readTrace(MFIButtonTraceRecord *records, uint16_t max);
+    // Prints the trace, one "time type button value" line per record
+    static void printTrace(Print &out);
+    static void clearTrace();
+    // Buttons are numbered in order of construction
+    uint8_t getTraceId() { return trace_id_; };
+    // Feeds the edges of this button from a trace into its state machine,
+    // and runs its timers at the times they fired, so it takes the same
+    // decisions again and calls the same handlers. This is meant for
+    // offline use, the button's pin and the hardware timer are left alone.
+    // The replay is traced as well, for comparing with the original.
+    void replayTrace(const MFIButtonTraceRecord *records, uint16_t count);
+#endif
+#if MFI_BUTTON_SLEEP
+    // If idle, sleeps until a started button is pressed, and handles the
+    // press. That's light sleep with GPIO wakeup on ESP32, and power down
+    // with pin change wakeup on AVR. Returns false right away if not idle.
+    static bool sleep();
+#endif
+    // Does the work that can't be done in interrupt context, like reading
+    // port expanders. With deferred dispatch it then calls the handlers for
+    // all queued events, and returns how many there were. Only call this
+    // from one place, the queue has a single consumer.
+    static uint8_t dispatch();
+#if MFI_BUTTON_DEFERRED_DISPATCH
+    // Number of events dropped because the queue was full
+    static uint16_t getEventQueueOverflowCount() {
+        return event_queue_overflows_;
+    };
+#endif
+#if MFI_BUTTON_BATCH_EVENTS
+    // Gets the events of all buttons in one call per batch, instead of a
+    // call per event. The handlers registered with the buttons still decide
+    // which events there are, but aren't called. With deferred dispatch,
+    // dispatch() hands over everything that was queued, in batches. With
+    // coalesce, a press that was released again in the same batch is left
+    // out, along with its release, for callbacks that only care about
+    // clicks and long presses. NULL goes back to calling the handlers.
+    static void onEvents(events_callback_t callback, bool coalesce = false);
+#endif
+#ifdef MFI_BUTTON_HAS_FREERTOS
+    // Blocks the calling task until there is something to dispatch, or the
+    // timeout passes. Returns true if there is. The first task to call this
+    // becomes the task that gets notified.
+    static bool waitForEvents(TickType_t timeout = portMAX_DELAY);
+    // Starts a task that waits for events and dispatches them, so the
+    // handlers run outside of interrupt context without any code in loop().
+    static bool startDispatchTask(
+        UBaseType_t priority = 1, uint32_t stack_size = 2048,
+        BaseType_t core = MFI_BUTTON_CORE < 0 ? tskNO_AFFINITY
+                                              : MFI_BUTTON_CORE);
+#endif
     int getPin() { return pin_; };
     bool isPullup() { return pullup_; };
     bool isInverted() { return inverted_; };
+    // True if the pin has no interrupt, so begin() made it a polled button
+    bool isPolled() { return polled_; };
+    // Whatever the handlers need to know about this button, handed to them
+    // through MFIButtonEvent::context(). See also MFIButtonDelegate.
+    void setContext(void *context) { context_ = context; };
+    void *getContext() { return context_; };
+    // Uses the handlers and timings of a profile, which any number of
+    // buttons can share, instead of its own. NULL goes back to no handlers.
+    // The registering functions above give the button its own handlers
+    // again, starting from none.
+    //
+    // This is a single pointer store, so it's the way to change the whole
+    // setup of a running button: fill in a profile that no button uses yet,
+    // and then switch to it. The interrupt handlers see either the old or
+    // the new profile, never half of one. A profile the button allocated
+    // for itself is freed.
+    void setProfile(MFIButtonProfile *profile);
+    const MFIButtonProfile *getProfile() { return profile_; };
 
    private:
+    template <uint8_t, bool, bool, typename...>
+    friend class MFIStaticButton;
+    friend class MFIButtonScanner;
+    friend class MFIButtonChord;
+    friend class MFIButtonProfile;
+
+    // Keys of a scanner have no pin of their own
+    static const uint8_t NO_PIN_ = 0xFF;
+    // Keeps the interrupt handlers out, also on a single core, for changes
+    // they must not see halfway. Can be nested, and called from handlers.
+    static void lock_();
+    static void unlock_();
+    MFIButton()
+        : inverted_(false),
+          pullup_(false),
+          polled_(false),
+          long_press_on_release_(false),
+          owns_profile_(false),
+          started_(false),
+          last_state_(true),
+#if MFI_BUTTON_CHORDS
+          chord_consumed_(false),
+#endif
+          pin_(NO_PIN_){};
+
     enum timer_type_t_ {
         TIMER_TYPE_LONG_PRESS,
         TIMER_TYPE_SEQUENCE,
+        TIMER_TYPE_DEBOUNCE,
+        TIMER_TYPE_SCAN,
+        TIMER_TYPE_POLL,
+        TIMER_TYPE_REPEAT,
+        TIMER_TYPE_CHORD,
     };
-    // These two use SLIST to save memory. It would be nice to have
+    // This uses SLIST to save memory. It would be nice to have
     // _INSERT_BEFORE, but we'll just have to use _INSERT_AFTER and
     // pay the price of keeping a pointer to previous while we're
     // inserting. It's only done during setup, so that's fine.
@@ -74,65 +629,498 @@ class MFIButton {
         event_callback_t callback;
         SLIST_ENTRY(sequence_t_) entries;
     };
+    // Long presses are kept in an array sorted by duration, since the timer
+    // handler needs to step to the next one. The array is either allocated
+    // by onLongPress(), or a constant table from MFIStaticButton.
     struct long_press_t_ {
         uint16_t duration;
         event_callback_t callback;
-        SLIST_ENTRY(long_press_t_) entries;
     };
 
+#if MFI_BUTTON_COMPACT
+    // The same as a TAILQ, with indexes into the pool for links
+    typedef uint8_t timer_index_t_;
+    static const timer_index_t_ NO_TIMER_ = 0xFF;
+    struct timer_links_t_ {
+        timer_index_t_ next;
+        timer_index_t_ prev;
+    };
+    // Times when the button was last pressed and released, for debounce
+    // and the length of a press. The differences are done in 16 bits too.
+    typedef uint16_t stamp_t_;
+#else
+    typedef unsigned long stamp_t_;
+#endif
+
     // This uses a TAILQ because we need to be able to _INSERT_BEFORE quickly,
     // _REMOVE quickly, and add to the end of the list quickly, since we're
     // running those in interrupt handlers. Since it's static, there's only one
     // list, so we can suffer the extra memory.
     struct timer_t_ {
+        // This stays 32 bits even when compact. Timers can be up to 65
+        // seconds away, which 16 bits can't order.
         unsigned long trigger_time;
+#if MFI_BUTTON_COMPACT
+        uint8_t type;
+#else
         timer_type_t_ type;
+#endif
         MFIButton *button;
         union {
-            long_press_t_ *long_press;
-            unsigned long release_time;
+            const long_press_t_ *long_press;
+            MFIButtonScanner *scanner;
+            MFIButtonChord *chord;
+            // The interval to the next repeat, and how many have been sent
+            struct {
+                uint16_t interval;
+                uint16_t count;
+            } repeat;
         } data;
+#if MFI_BUTTON_COMPACT
+        timer_links_t_ entries;
+#else
         TAILQ_ENTRY(timer_t_) entries;
+#endif
     };
 
-    static TAILQ_HEAD(timers_head_, MFIButton::timer_t_) timers_;
+#if MFI_BUTTON_COMPACT
+    struct timers_head_ {
+        timer_index_t_ first;
+        timer_index_t_ last;
+    };
+    static timer_t_ *timer_at_(timer_index_t_ index) {
+        return index == NO_TIMER_ ? NULL : &timer_pool_[index];
+    };
+    // With before NULL, it goes at the end
+    static void timers_insert_before_(timers_head_ *head, timer_t_ *before,
+                                      timer_t_ *timer);
+    static void timers_remove_(timers_head_ *head, timer_t_ *timer);
+#else
+    TAILQ_HEAD(timers_head_, MFIButton::timer_t_);
+#endif
+#if MFI_BUTTON_TIMER_WHEEL
+    static struct timers_head_ wheel_[MFI_BUTTON_TIMER_WHEEL_SLOTS];
+    // One bit per slot that has timers in it, to skip empty slots quickly
+    static uint32_t wheel_used_;
+    // The earliest timer on the wheel, which is the one set_timer_ is for
+    static timer_t_ *wheel_first_;
+    static uint8_t wheel_slot_(unsigned long time);
+    static timer_t_ *wheel_find_first_(unsigned long from);
+#else
+    static struct timers_head_ timers_;
+#endif
     static SLIST_CLASS_HEAD(all_buttons_head_, MFIButton) started_buttons_;
+    // Only the buttons that have to be checked by the shared pin interrupt
+    // handler, because they couldn't get a direct dispatch.
+    static struct all_buttons_head_ scanned_buttons_;
+    // Buttons without an interrupt. A button is only ever on one of these
+    // two lists, so they share the list entry.
+    static struct all_buttons_head_ polled_buttons_;
+    static timer_t_ *poll_timer_;
+#if MFI_BUTTON_DIRECT_DISPATCH && !defined(MFI_BUTTON_HAS_INTERRUPT_ARG)
+    static MFIButton *dispatch_slots_[MFI_BUTTON_DISPATCH_SLOTS];
+    // Generates one argument-less interrupt handler per slot
+    template <uint8_t slot, bool first = (slot == 0)>
+    struct slot_handler_;
+#endif
     static timer_callback_t set_timer_;
+    static tick_timer_callback_t set_tick_timer_;
+#ifdef MFI_BUTTON_HAS_PORT_REGISTERS
+#ifdef __AVR__
+    typedef uint8_t port_reg_t_;
+#else
+    typedef uint32_t port_reg_t_;
+#endif
+    // Bits are set in invert for inverted buttons, and in state for buttons
+    // whose last_state_ is true, so that (input ^ invert ^ state) & mask has
+    // a bit set for every button that changed.
+    struct port_group_t_ {
+        volatile port_reg_t_ *reg;
+        port_reg_t_ mask;
+        port_reg_t_ invert;
+        port_reg_t_ state;
+    };
+    static const uint8_t NO_PORT_GROUP_ = 0xFF;
+    static port_group_t_ port_groups_[MFI_BUTTON_PORT_GROUPS];
+    static uint8_t port_group_count_;
+#endif
+    struct queued_event_t_ {
+        event_callback_t callback;
+        MFIButtonEvent event;
+    };
+#if defined(MFI_BUTTON_HAS_SPINLOCK) || MFI_BUTTON_BATCH_EVENTS
+    // Events emitted while the lock is held. A single input change or timer
+    // emits at most two, and the lock is released after each, also between
+    // the keys of a scan. When batching, these are the events of the passes
+    // going on.
+    struct pending_events_t_ {
+        uint8_t count;
+#if MFI_BUTTON_BATCH_EVENTS
+        queued_event_t_ events[MFI_BUTTON_BATCH_SIZE];
+#else
+        queued_event_t_ events[4];
+#endif
+    };
+    static pending_events_t_ pending_;
+#endif
+#ifdef MFI_BUTTON_HAS_SPINLOCK
+    static portMUX_TYPE spinlock_;
+    static void enter_critical_();
+    // Releases the lock, then calls the handlers of the pending events
+    static void exit_critical_();
+#endif
+    // Lets go of the lock for a moment, to hand over what was emitted with
+    // it held. For code that makes many changes under one lock.
+    static void hand_over_events_() {
+#if defined(MFI_BUTTON_HAS_SPINLOCK) && !MFI_BUTTON_DEFERRED_DISPATCH
+        MFIButton::exit_critical_();
+        MFIButton::enter_critical_();
+#endif
+    };
+#if MFI_BUTTON_BATCH_EVENTS
+    static events_callback_t on_events_;
+    static bool coalesce_;
+    // Passes of the interrupt handlers going on. The batch is handed over
+    // when the last one ends.
+    static uint8_t batch_depth_;
+    static void begin_batch_();
+    static void end_batch_();
+    // Queues or delivers pending_, has to be called with the lock held
+    static void flush_batch_();
+#endif
+    // Calls the handlers, or the batch callback, for events that were
+    // collected or queued
+    static void deliver_(const queued_event_t_ *entries, uint8_t count);
+#if MFI_BUTTON_DEFERRED_DISPATCH
+    // Single producer, single consumer ring. The producers are the interrupt
+    // handlers, which don't interrupt each other, or hold the spinlock on
+    // ESP32. Head is only written by them, and tail only by dispatch().
+    static queued_event_t_ event_queue_[MFI_BUTTON_EVENT_QUEUE_SIZE];
+    static volatile uint8_t event_queue_head_;
+    static volatile uint8_t event_queue_tail_;
+    static volatile uint16_t event_queue_overflows_;
+    // Adds events to the queue, with the lock held. What doesn't fit is
+    // dropped.
+    static void queue_events_(const queued_event_t_ *entries, uint8_t count);
+#endif
+    // Scanners that can ask dispatch() to do work for them
+    static SLIST_CLASS_HEAD(scanners_head_, MFIButtonScanner) work_scanners_;
+    static volatile bool work_requested_;
+    // Wakes up the task in waitForEvents()
+    static void notify_dispatch_();
+#ifdef MFI_BUTTON_HAS_FREERTOS
+    static TaskHandle_t volatile dispatch_task_;
+    static void dispatch_task_loop_(void *arg);
+#endif
+    // Unused timers are kept on their own list, reusing the entries
+    static struct timers_head_ free_timers_;
+    static timer_t_ timer_pool_[MFI_BUTTON_TIMER_POOL_SIZE];
+    static bool timer_pool_ready_;
+    static volatile uint16_t timer_pool_exhausted_;
+    static uint8_t timers_in_use_;
+    // For buttons without handlers, it's never changed
+    static MFIButtonProfile default_profile_;
+#if MFI_BUTTON_COMPACT
+    // When any button was last pressed or released
+    static unsigned long last_edge_time_;
+#endif
+#if MFI_BUTTON_TRACE
+    static MFIButtonTraceRecord trace_ring_[MFI_BUTTON_TRACE_SIZE];
+    static uint16_t trace_head_;
+    static bool trace_wrapped_;
+    static uint8_t next_trace_id_;
+    // Keeps replayTrace() away from the pins and the hardware timer
+    static bool replaying_;
+    // Has to be called with the lock held
+    static void trace_(uint8_t type, const MFIButton *button, uint16_t value,
+                       unsigned long time);
+#endif
+#if MFI_BUTTON_STATS
+    static MFIButtonStats stats_;
+    static uint32_t stats_clock_();
+    // Adds the time since start, has to be called with the lock held
+    static void add_handler_time_(MFIButtonHandlerStats *stats,
+                                  uint32_t start);
+    static void count_event_(const MFIButtonEvent &event);
+#endif
 
-    bool inverted_;
-    bool pullup_;
-    bool last_state_;
+    // These are only changed by the registering task and begin()
+    bool inverted_ MFI_BUTTON_FLAG_BITS;
+    bool pullup_ MFI_BUTTON_FLAG_BITS;
+    bool polled_ MFI_BUTTON_FLAG_BITS;
+    bool long_press_on_release_ MFI_BUTTON_FLAG_BITS;
+    // Set when profile_ was allocated by this button, and not shared
+    bool owns_profile_ MFI_BUTTON_FLAG_BITS;
+    // Between begin() and end()
+    bool started_ MFI_BUTTON_FLAG_BITS;
+#if MFI_BUTTON_COMPACT
+    // The interrupt handlers change the ones below, so they get a byte of
+    // their own. Without the spinlock, nothing stops an interrupt in the
+    // middle of changing another bit in the same byte.
+    uint8_t : 0;
+#endif
+    bool last_state_ MFI_BUTTON_FLAG_BITS;
+#if MFI_BUTTON_CHORDS
+    // Set when a chord took the press, so it's not a click or long press
+    bool chord_consumed_ MFI_BUTTON_FLAG_BITS;
+#endif
+#if MFI_BUTTON_CHORDS
+    static const uint8_t NO_CHORD_ = 0xFF;
+    // This button's bit in MFIButtonChord's mask of pressed buttons
+    uint8_t chord_index_ = NO_CHORD_;
+#endif
     uint8_t pin_;
-    uint8_t longest_sequence_ = 0;
+    void *context_ = NULL;
+#if MFI_BUTTON_TRACE
+    uint8_t trace_id_ = next_trace_id_++;
+#endif
+#ifdef MFI_BUTTON_HAS_PORT_REGISTERS
+    volatile port_reg_t_ *input_reg_ = NULL;
+    port_reg_t_ bit_mask_ = 0;
+    uint8_t port_group_ = NO_PORT_GROUP_;
+#endif
     uint8_t sequence_clicks_ = 0;
-    uint16_t longest_long_press_ = 0;
-    uint16_t debounce_time_ = MFI_BUTTON_DEFAULT_DEBOUNCE;
-    uint16_t sequence_delay_ = MFI_BUTTON_DEFAULT_SEQUENCE_DELAY;
-    unsigned long last_press_time_ = 0;
-    unsigned long last_release_time_ = 0;
-    // This is a double linked list, because we need _INSERT_BEFORE.
-    // Inserting timers is done in an interrupt, so should be as fast
-    // as possible.
-    SLIST_HEAD(sequences_head_, sequence_t_)
-    sequence_handlers_ = SLIST_HEAD_INITIALIZER(sequence_handlers_);
-    SLIST_HEAD(long_presss_head_, long_press_t_)
-    long_press_handlers_ = SLIST_HEAD_INITIALIZER(long_press_handlers_);
+    stamp_t_ last_press_time_ = 0;
+    stamp_t_ last_release_time_ = 0;
+    MFIButtonProfile *profile_ = &default_profile_;
     SLIST_CLASS_ENTRY(MFIButton) started_entries_ = {NULL};
+    SLIST_CLASS_ENTRY(MFIButton) scanned_entries_ = {NULL};
     event_callback_t on_press_ = NULL;
     event_callback_t on_release_ = NULL;
+    event_callback_t on_repeat_ = NULL;
+    uint16_t repeat_delay_ = 0;
+    uint16_t repeat_interval_ = 0;
+    uint16_t repeat_fastest_ = 0;
+    // Pending timers of this button, so they can be cancelled as soon as
+    // they become stale, instead of firing for nothing.
+    timer_t_ *sequence_timer_ = NULL;
+    timer_t_ *long_press_timer_ = NULL;
+    timer_t_ *repeat_timer_ = NULL;
+#if MFI_BUTTON_STATS
+    MFIButtonCounters counters_ = {};
+#endif
+#if MFI_BUTTON_GLITCH_FILTER
+    gpio_glitch_filter_handle_t glitch_filter_ = NULL;
+#endif
+#if MFI_BUTTON_DEBOUNCE_MASKING
+    timer_t_ *debounce_timer_ = NULL;
+#if !defined(ESP32) && !defined(ARDUINO_ARCH_RP2040)
+    // Masking is done by detaching, so we need to know what to attach again
+    callback_t interrupt_handler_ = NULL;
+#endif
+#endif
 
     bool digital_read_();
     void send_press_release_(bool state);
     void send_sequence_(uint8_t clicks);
-    void send_long_press_(long_press_t_ *long_press);
-    void set_long_press_timer_(long_press_t_ *long_press, uint16_t delay,
-                               unsigned long now);
+    void send_long_press_(const long_press_t_ *long_press);
+    void set_long_press_timer_(const long_press_t_ *long_press,
+                               uint16_t delay, unsigned long now);
     void add_click_release_timer_(unsigned long now);
     void check_click_release_(timer_t_ *timer);
     void check_long_press_(timer_t_ *timer, unsigned long now);
+    // The longest long press that's no longer than press_time ticks, there
+    // has to be at least one.
+    const long_press_t_ *find_long_press_(unsigned long press_time) const;
+    void set_repeat_timer_(unsigned long now);
+    // Returns true if the timer went back in the queue for the next repeat
+    bool check_repeat_(timer_t_ *timer, unsigned long now);
+    // The profile that the registering functions change, which is
+    // allocated the first time
+    MFIButtonProfile *own_profile_();
+    void attach_interrupt_(int interrupt, callback_t handler);
+    // Attaches on MFI_BUTTON_CORE, if set, like every other input
+    static void attach_handler_(int interrupt, callback_t handler, int mode);
+#ifdef MFI_BUTTON_HAS_INTERRUPT_ARG
+    static void attach_interrupt_(int interrupt, void (*handler)(void *),
+                                  void *arg, int mode = CHANGE);
+#endif
+#if MFI_BUTTON_DEBOUNCE_MASKING
+    void start_debounce_(unsigned long now);
+    void check_debounce_(unsigned long now);
+    void mask_interrupt_();
+    void unmask_interrupt_();
+#endif
+    void pin_changed_(unsigned long now);
+    void input_changed_(bool state, unsigned long now);
+    // Pressed or within the debounce period
+    bool busy_(unsigned long now) const;
+    // Within the debounce period, so an edge now would be ignored
+    bool bouncing_(unsigned long now) const;
+#ifdef MFI_BUTTON_HAS_PORT_REGISTERS
+    void join_port_group_();
+    void sync_port_group_();
+#endif
+
+    // All events go through here, so they can be deferred
+    static void emit_(event_callback_t callback, const MFIButtonEvent &event);
 
+    // Sets up the timer callback and pool, for anything that has begin()
+    static void init_timers_();
     static void pin_interrupt_handler_();
+    // Handles the timers that expired by now
+    static void run_timers_(unsigned long now);
+    // Reads the buttons on the list, one register read per port group
+    static void check_buttons_(all_buttons_head_ *buttons, unsigned long now);
+    static void poll_buttons_(unsigned long now);
+    // Sets the poll timer, if there is none and there are polled buttons
+    static void schedule_poll_(unsigned long now);
+    // Reads every started button, for when edges may have been missed
+    static void check_all_buttons_();
+    static void direct_interrupt_handler_(void *arg);
+    static unsigned long now_() { return MFI_BUTTON_TICKS(); };
+    static unsigned long ms_to_ticks_(uint16_t ms) {
+        return (unsigned long)ms * MFI_BUTTON_TICKS_PER_MS;
+    };
+    // True if tick a comes before tick b, even across a wrap of the counter,
+    // as long as they're less than half the counter range apart.
+    static bool before_(unsigned long a, unsigned long b) {
+        return (long)(a - b) < 0;
+    };
+    // Ticks from stamp to now, in the width of stamp_t_ so it wraps the same
+    static unsigned long since_(stamp_t_ stamp, unsigned long now) {
+        return (stamp_t_)((stamp_t_)now - stamp);
+    };
+    static void arm_timer_(unsigned long ticks);
+    // These make up the timer queue. Whichever way the timers are kept,
+    // insert_timer_() calls arm_timer_() when the new timer is the earliest.
     static void insert_timer_(timer_t_ *timer, unsigned long now);
+    static timer_t_ *first_timer_();
+    static timer_t_ *pop_expired_timer_(unsigned long now);
+    static void remove_timer_(timer_t_ *timer);
+    static void cancel_timer_(timer_t_ **timer);
+    static void init_timer_pool_();
+    static timer_t_ *alloc_timer_();
+    static void free_timer_(timer_t_ *timer);
+};
+
+// The handlers of buttons, and their timings. Buttons that are set up the
+// same can share a profile with MFIButton::setProfile(), so that everything
+// in it is only there once, and each button is just its state. It can be
+// changed after the buttons are started, that works for all of them.
+//
+//   MFIButtonProfile keys;
+//   keys.onClick(MFIButtonDelegate::call);
+//   keys.onLongPress(1000, MFIButtonDelegate::call);
+//   for (MFIButton &button : buttons) {
+//       button.setProfile(&keys);
+//   }
+class MFIButtonProfile {
+   public:
+    typedef MFIButton::callback_t callback_t;
+    typedef MFIButton::event_callback_t event_callback_t;
+
+    // Nothing to construct at run time, so a global profile is ready
+    // before the constructors of any buttons run.
+    constexpr MFIButtonProfile(){};
+    void onSequence(uint8_t clicks, event_callback_t callback);
+    void onSequence(uint8_t clicks, callback_t callback);
+    void onClick(event_callback_t callback);
+    void onClick(callback_t callback);
+    void onDoubleClick(event_callback_t callback);
+    void onDoubleClick(callback_t callback);
+    void onLongPress(uint16_t duration, event_callback_t callback);
+    void onLongPress(uint16_t duration, callback_t callback);
+    void setDebounceTime(uint16_t ms) { debounce_time_ = ms; };
+    uint16_t getDebounceTime() const { return debounce_time_; };
+    // How long to wait after a click for the next one of a sequence
+    void setSequenceDelay(uint16_t ms) { sequence_delay_ = ms; };
+    uint16_t getSequenceDelay() const { return sequence_delay_; };
+    // Removes all handlers, and frees what the registering functions
+    // allocated for them. Safe while buttons use the profile, their long
+    // presses that are on the way are dropped.
+    void clear();
+
+   private:
+    friend class MFIButton;
+    template <uint8_t, bool, bool, typename...>
+    friend class MFIStaticButton;
+    typedef MFIButton::sequence_t_ sequence_t_;
+    typedef MFIButton::long_press_t_ long_press_t_;
+
+    void build_sequence_table_();
+
+    // Sorted by clicks. Only used by the interrupt handlers when there's
+    // no table.
+    SLIST_HEAD(sequences_head_, MFIButton::sequence_t_)
+    sequence_handlers_ = SLIST_HEAD_INITIALIZER(sequence_handlers_);
+    // Callbacks indexed by clicks, with longest_sequence_ + 1 entries. This
+    // is either built by onSequence(), or a constant from MFIStaticButton.
+    const event_callback_t *sequence_table_ = NULL;
+    uint8_t sequence_table_size_ = 0;
+    uint8_t longest_sequence_ = 0;
+    uint8_t long_press_count_ = 0;
+    uint16_t longest_long_press_ = 0;
+    uint16_t debounce_time_ = MFI_BUTTON_DEFAULT_DEBOUNCE;
+    uint16_t sequence_delay_ = MFI_BUTTON_DEFAULT_SEQUENCE_DELAY;
+    const long_press_t_ *long_presses_ = NULL;
+};
+
+inline void *MFIButtonEvent::context() const {
+    return this->button_->getContext();
+}
+
+// Base for front-ends that read the inputs of many keys themselves, and feed
+// them into MFIButton keys, so the keys share a single interrupt. scan_() is
+// run from the timer interrupt handler, with the same locking as the button
+// state machine.
+class MFIButtonScanner {
+   protected:
+    friend class MFIButton;
+    // Reads all inputs and feeds them to the keys. Should schedule the next
+    // scan for as long as any key is busy.
+    virtual void scan_(unsigned long now) = 0;
+    // For interrupt handlers: scans right away, unless a scan is scheduled
+    void wake_();
+    // Returns false if there was no timer, then the next wake_() is needed
+    bool schedule_scan_(uint16_t delay, unsigned long now);
+    static MFIButton *make_keys_(uint8_t count);
+    // With the lock held. It's let go of for a moment afterwards, so a scan
+    // can feed any number of keys without running out of room for events.
+    static void feed_(MFIButton *key, bool released, unsigned long now) {
+        key->input_changed_(released, now);
+        MFIButton::hand_over_events_();
+    };
+    // True while the key is pressed or bouncing, so it has to be scanned
+    static bool key_busy_(const MFIButton *key, unsigned long now) {
+        return key->busy_(now);
+    };
+    static bool key_bouncing_(const MFIButton *key, unsigned long now) {
+        return key->bouncing_(now);
+    };
+    static void init_timers_() { MFIButton::init_timers_(); };
+    static unsigned long now_() { return MFIButton::now_(); };
+    // attachInterrupt(), on the core the buttons' interrupts are on
+    static void attach_interrupt_(int interrupt, MFIButton::callback_t handler,
+                                  int mode) {
+        MFIButton::attach_handler_(interrupt, handler, mode);
+    };
+    // For scanners with events of their own. With the lock held, like all
+    // events.
+    static void emit_(MFIButton::event_callback_t callback,
+                      const MFIButtonEvent &event) {
+        MFIButton::emit_(callback, event);
+    };
+    // The state machine lock, for feeding keys outside of scan_(). Without
+    // the spinlock this turns interrupts off.
+    static void lock_();
+    static void unlock_();
+
+    // Called by dispatch(), for reads that can't be done in an interrupt
+    virtual void work_(){};
+    // Needed once before request_work_() can be used
+    void enable_work_();
+    // Has dispatch() call work_(). Safe in interrupt handlers, and requests
+    // made before work_() gets to run are combined into one.
+    void request_work_();
+
+   private:
+    MFIButton::timer_t_ *scan_timer_ = NULL;
+    volatile bool work_pending_ = false;
+    bool work_enabled_ = false;
+    SLIST_CLASS_ENTRY(MFIButtonScanner) work_entries_ = {NULL};
+    // In scan_(), which lets go of the lock between keys
+    bool scanning_ = false;
 };
 
 #endif  // _MFIBUTTON_H
@@ -0,0 +1,161 @@
+#include "MFIButtonChord.h"
+
+#if MFI_BUTTON_CHORDS
+
+struct MFIButtonChord::chords_head_ MFIButtonChord::chords_ =
+    SLIST_HEAD_INITIALIZER(chords_);
+uint32_t MFIButtonChord::pressed_mask_ = 0;
+uint8_t MFIButtonChord::next_index_ = 0;
+
+MFIButtonChord::MFIButtonChord(MFIButton *const *buttons, uint8_t count,
+                               uint16_t window)
+    : count_(count), window_(window) {
+    // Copy the buttons, so the array doesn't have to stay around
+    this->buttons_ = new MFIButton *[count];
+    memcpy(this->buttons_, buttons, count * sizeof(MFIButton *));
+}
+
+MFIButtonChord::MFIButtonChord(MFIButton &first, MFIButton &second,
+                               uint16_t window)
+    : count_(2), window_(window) {
+    this->buttons_ = new MFIButton *[2];
+    this->buttons_[0] = &first;
+    this->buttons_[1] = &second;
+}
+
+// Chords are only set up from loop() or setup(), while the handlers can run
+void MFIButtonChord::onHold(event_callback_t callback, uint16_t hold) {
+    MFIButton::lock_();
+    this->hold_ = hold;
+    this->on_hold_ = callback;
+    MFIButton::unlock_();
+}
+
+void MFIButtonChord::onClick(event_callback_t callback) {
+    // A pointer takes more than one store on 8 bit boards
+    MFIButton::lock_();
+    this->on_click_ = callback;
+    MFIButton::unlock_();
+}
+
+bool MFIButtonChord::begin() {
+    // Count the buttons that still need a bit before handing any out
+    uint8_t needed = 0;
+    for (uint8_t i = 0; i < this->count_; i++) {
+        if (this->buttons_[i]->chord_index_ == MFIButton::NO_CHORD_) {
+            needed++;
+        }
+    }
+    if (MFIButtonChord::next_index_ + needed > 32) {
+        return false;
+    }
+    // The timer pool is needed for the hold timer
+    MFIButton::init_timers_();
+    // Buttons that are already down only count from their next press
+    MFIButton::lock_();
+    uint32_t mask = 0;
+    for (uint8_t i = 0; i < this->count_; i++) {
+        MFIButton *button = this->buttons_[i];
+        if (button->chord_index_ == MFIButton::NO_CHORD_) {
+            button->chord_index_ = MFIButtonChord::next_index_++;
+        }
+        mask |= (uint32_t)1 << button->chord_index_;
+    }
+    this->mask_ = mask;
+    SLIST_INSERT_HEAD(&MFIButtonChord::chords_, this, entries_);
+    MFIButton::unlock_();
+    return true;
+}
+
+void MFI_BUTTON_ISR_ATTR MFIButtonChord::pressed_(MFIButton *button,
+                                                  unsigned long now) {
+    uint32_t bit = (uint32_t)1 << button->chord_index_;
+    MFIButtonChord::pressed_mask_ |= bit;
+    MFIButtonChord *chord;
+    SLIST_FOREACH(chord, &MFIButtonChord::chords_, entries_) {
+        if ((chord->mask_ & bit) == 0) {
+            continue;
+        }
+        uint32_t down = MFIButtonChord::pressed_mask_ & chord->mask_;
+        if (down == bit) {
+            // The first one, the window starts here
+            chord->first_press_ = now;
+        }
+        if (down != chord->mask_) {
+            continue;
+        }
+        chord->last_ = button;
+        if (now - chord->first_press_ >
+            MFIButton::ms_to_ticks_(chord->window_)) {
+            // Too late to be together, but the release can be a click
+            chord->click_pending_ = chord->on_click_ != NULL;
+            continue;
+        }
+        if (chord->on_hold_ == NULL) {
+            continue;
+        }
+        chord->consume_();
+        if (chord->hold_ == 0) {
+            chord->held_();
+            continue;
+        }
+        MFIButton::cancel_timer_(&chord->hold_timer_);
+        MFIButton::timer_t_ *timer = MFIButton::alloc_timer_();
+        if (timer == NULL) {
+            continue;
+        }
+        timer->trigger_time = now + MFIButton::ms_to_ticks_(chord->hold_);
+        timer->type = MFIButton::TIMER_TYPE_CHORD;
+        timer->button = button;
+        timer->data.chord = chord;
+        chord->hold_timer_ = timer;
+        MFIButton::insert_timer_(timer, now);
+    }
+}
+
+void MFI_BUTTON_ISR_ATTR MFIButtonChord::released_(MFIButton *button,
+                                                   bool click) {
+    uint32_t bit = (uint32_t)1 << button->chord_index_;
+    MFIButtonChord::pressed_mask_ &= ~bit;
+    MFIButtonChord *chord;
+    SLIST_FOREACH(chord, &MFIButtonChord::chords_, entries_) {
+        if ((chord->mask_ & bit) == 0) {
+            continue;
+        }
+        // The chord is broken up, so it's not held any longer
+        MFIButton::cancel_timer_(&chord->hold_timer_);
+        if (!chord->click_pending_) {
+            continue;
+        }
+        chord->click_pending_ = false;
+        if (click && chord->last_ == button) {
+            // Released while the others are still held
+            chord->consume_();
+            MFIButton::emit_(chord->on_click_,
+                             MFIButtonEvent(MFIButtonEvent::CHORD, button, 0));
+        }
+    }
+}
+
+void MFI_BUTTON_ISR_ATTR MFIButtonChord::held_() {
+    this->hold_timer_ = NULL;
+    // A release cancels the timer, but not if it was lost in debounce
+    if ((MFIButtonChord::pressed_mask_ & this->mask_) != this->mask_ ||
+        this->on_hold_ == NULL) {
+        return;
+    }
+    MFIButton::emit_(this->on_hold_, MFIButtonEvent(MFIButtonEvent::CHORD,
+                                                    this->last_, this->hold_));
+}
+
+void MFI_BUTTON_ISR_ATTR MFIButtonChord::consume_() {
+    for (uint8_t i = 0; i < this->count_; i++) {
+        MFIButton *button = this->buttons_[i];
+        button->chord_consumed_ = true;
+        MFIButton::cancel_timer_(&button->sequence_timer_);
+        MFIButton::cancel_timer_(&button->long_press_timer_);
+        MFIButton::cancel_timer_(&button->repeat_timer_);
+    }
+}
+
+#endif  // MFI_BUTTON_CHORDS
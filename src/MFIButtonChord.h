@@ -0,0 +1,79 @@
+#ifndef _MFIBUTTONCHORD_H
+#define _MFIBUTTONCHORD_H
+
+#include "MFIButton.h"
+
+#if MFI_BUTTON_CHORDS
+
+// How close together in ms the presses of a chord have to be, by default
+#ifndef MFI_BUTTON_CHORD_WINDOW
+#define MFI_BUTTON_CHORD_WINDOW 100
+#endif
+
+// Two or more buttons used together, in one of two ways:
+//
+// - Held together: all of them pressed within the window of the first, like
+//   A+B. onHold() fires once they've all been down for the hold time, using
+//   a timer from the pool.
+// - Hold and click: all but one held, and the last one pressed later and let
+//   go again, like holding A and clicking B. onClick() fires on that release.
+//
+// Either way, the buttons' own clicks, long presses and repeats are dropped
+// for the rest of the press, since the chord took it. Presses and releases
+// are still sent. A long press that fired before the chord was complete has
+// already happened, though.
+//
+// The pressed state of all buttons in chords is kept in one bitmask, so a
+// chord is matched with a single compare. That allows for 32 buttons in
+// chords, and a button can be in any number of them.
+class MFIButtonChord {
+   public:
+    typedef MFIButton::event_callback_t event_callback_t;
+
+    MFIButtonChord(MFIButton *const *buttons, uint8_t count,
+                   uint16_t window = MFI_BUTTON_CHORD_WINDOW);
+    MFIButtonChord(MFIButton &first, MFIButton &second,
+                   uint16_t window = MFI_BUTTON_CHORD_WINDOW);
+    void onHold(event_callback_t callback, uint16_t hold = 0);
+    void onClick(event_callback_t callback);
+    // Fails if there would be more than 32 buttons in chords. Can be called
+    // before or after begin() of the buttons.
+    bool begin();
+
+   protected:
+    friend class MFIButton;
+    // Called by the state machine of a button in a chord, with the lock held.
+    // end() of a button releases it without a click.
+    static void pressed_(MFIButton *button, unsigned long now);
+    static void released_(MFIButton *button, bool click = true);
+    // The hold timer fired
+    void held_();
+
+   private:
+    static SLIST_CLASS_HEAD(chords_head_, MFIButtonChord) chords_;
+    static uint32_t pressed_mask_;
+    static uint8_t next_index_;
+
+    // Drops what the buttons would still send for this press
+    void consume_();
+
+    MFIButton **buttons_;
+    uint8_t count_;
+    uint16_t window_;
+    uint16_t hold_ = 0;
+    uint32_t mask_ = 0;
+    event_callback_t on_hold_ = NULL;
+    event_callback_t on_click_ = NULL;
+    // When the first of the buttons went down, and which one went last
+    unsigned long first_press_ = 0;
+    MFIButton *last_ = NULL;
+    // The chord was completed outside the window, so a release of the last
+    // button is a hold and click
+    bool click_pending_ = false;
+    MFIButton::timer_t_ *hold_timer_ = NULL;
+    SLIST_CLASS_ENTRY(MFIButtonChord) entries_ = {NULL};
+};
+
+#endif  // MFI_BUTTON_CHORDS
+
+#endif  // _MFIBUTTONCHORD_H
@@ -0,0 +1,86 @@
+#ifndef _MFIBUTTONDELEGATE_H
+#define _MFIBUTTONDELEGATE_H
+
+#include "MFIButton.h"
+
+// Bytes a delegate has for what its callable captures
+#ifndef MFI_BUTTON_DELEGATE_SIZE
+#define MFI_BUTTON_DELEGATE_SIZE (2 * sizeof(void *))
+#endif
+
+// Holds a callable, like a capturing lambda, in a fixed amount of space, so
+// that one handler with state can serve many buttons without std::function
+// or anything on the heap. It goes in as the context of the buttons, and
+// MFIButtonDelegate::call as their handler:
+//
+//   MFIButtonDelegate on_key([&menu](const MFIButtonEvent &event) {
+//       menu.key(event.button()->getPin(), event.type());
+//   });
+//   for (MFIButton &button : buttons) {
+//       button.setContext(&on_key);
+//       button.onClick(MFIButtonDelegate::call);
+//       button.onLongPress(1000, MFIButtonDelegate::call);
+//   }
+//
+// A plain function that takes a context pointer works too:
+//
+//   MFIButtonDelegate on_key(menu_key, &menu);
+//
+// The callable is copied byte for byte, so it has to be trivially copyable:
+// capture by reference, or plain values. Handlers are still plain function
+// pointers underneath, so event tables and queues don't grow any, and
+// getting to the delegate is a single load from the button.
+class MFIButtonDelegate {
+   public:
+    typedef void (*context_callback_t)(const MFIButtonEvent &, void *);
+
+    template <typename F>
+    MFIButtonDelegate(const F &callable) : invoke_(&invoke_callable_<F>) {
+        // The builtin, because AVR has no <type_traits>
+        static_assert(__is_trivially_copyable(F),
+                      "Callable must be trivially copyable, capture by "
+                      "reference or plain values");
+        static_assert(sizeof(F) <= sizeof(storage_),
+                      "Callable too big, raise MFI_BUTTON_DELEGATE_SIZE");
+        static_assert(alignof(F) <= alignof(storage_t_),
+                      "Callable needs more alignment than a delegate has");
+        memcpy(this->storage_.bytes, &callable, sizeof(F));
+    };
+    MFIButtonDelegate(context_callback_t callback, void *context)
+        : MFIButtonDelegate(bound_{callback, context}){};
+
+    void operator()(const MFIButtonEvent &event) const {
+        this->invoke_(this, event);
+    };
+
+    // The event handler, for buttons whose context is a delegate
+    static void call(MFIButtonEvent event) {
+        (*static_cast<const MFIButtonDelegate *>(event.context()))(event);
+    };
+
+   private:
+    struct bound_ {
+        context_callback_t callback;
+        void *context;
+        void operator()(const MFIButtonEvent &event) const {
+            this->callback(event, this->context);
+        };
+    };
+    union storage_t_ {
+        unsigned char bytes[MFI_BUTTON_DELEGATE_SIZE];
+        void *pointer;
+        void (*function)();
+        long long number;
+    };
+
+    template <typename F>
+    static void invoke_callable_(const MFIButtonDelegate *delegate,
+                                 const MFIButtonEvent &event) {
+        (*reinterpret_cast<const F *>(delegate->storage_.bytes))(event);
+    };
+
+    void (*invoke_)(const MFIButtonDelegate *, const MFIButtonEvent &);
+    storage_t_ storage_;
+};
+
+#endif  // _MFIBUTTONDELEGATE_H
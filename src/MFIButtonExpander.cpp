@@ -0,0 +1,209 @@
+#include "MFIButtonExpander.h"
+
+// MCP23x17 registers, with IOCON.BANK = 0 so A and B are next to each other
+static const uint8_t MCP_IODIR = 0x00;
+static const uint8_t MCP_GPINTEN = 0x04;
+static const uint8_t MCP_INTCON = 0x08;
+static const uint8_t MCP_IOCON = 0x0A;
+static const uint8_t MCP_GPPU = 0x0C;
+static const uint8_t MCP_INTF = 0x0E;
+static const uint8_t MCP_IOCON_MIRROR = 0x40;
+static const uint8_t MCP_IOCON_HAEN = 0x08;
+
+struct MFIButtonExpander::expanders_head_ MFIButtonExpander::expanders_ =
+    SLIST_HEAD_INITIALIZER(expanders_);
+
+MFIButtonExpander::MFIButtonExpander(uint8_t inputs, int interrupt_pin)
+    : inputs_(inputs), interrupt_pin_(interrupt_pin) {
+    this->keys_ = MFIButtonScanner::make_keys_(inputs);
+}
+
+bool MFIButtonExpander::begin() {
+    int interrupt = digitalPinToInterrupt(this->interrupt_pin_);
+    if (interrupt == NOT_AN_INTERRUPT) {
+        return false;
+    }
+    MFIButtonScanner::init_timers_();
+    if (!this->init_chip_()) {
+        return false;
+    }
+    this->enable_work_();
+    MFIButtonScanner::lock_();
+    SLIST_INSERT_HEAD(&expanders_, this, entries_);
+    MFIButtonScanner::unlock_();
+    // The interrupt outputs are open drain or active low, either way low
+    // means there's something to read.
+    pinMode(this->interrupt_pin_, INPUT_PULLUP);
+    MFIButtonScanner::attach_interrupt_(
+        interrupt, MFIButtonExpander::interrupt_handler_, FALLING);
+    // Pick up keys that are already down, this also clears the interrupt
+    this->work_();
+    return true;
+}
+
+void MFI_BUTTON_ISR_ATTR MFIButtonExpander::interrupt_handler_() {
+    // Expanders can share an interrupt line, so ask all of them to read.
+    // Only the ones that had changes will feed anything.
+    MFIButtonExpander *expander;
+    SLIST_FOREACH(expander, &expanders_, entries_) {
+        expander->request_work_();
+    }
+}
+
+void MFIButtonExpander::work_() {
+    uint16_t changed = 0;
+    uint16_t captured = 0;
+    uint16_t current = 0;
+    bool ok = this->read_inputs_(&changed, &captured, &current);
+    auto now = MFIButtonScanner::now_();
+    if (!ok) {
+        MFIButtonScanner::lock_();
+        this->read_errors_++;
+        // The interrupt line stays low until the chip is read, so there
+        // won't be another edge. Try again later.
+        this->schedule_scan_(MFI_BUTTON_EXPANDER_RECHECK, now);
+        MFIButtonScanner::unlock_();
+        return;
+    }
+    bool bouncing = false;
+    for (uint8_t i = 0; i < this->inputs_; i++) {
+        uint16_t bit = (uint16_t)1 << i;
+        MFIButton *key = &this->keys_[i];
+        // Locked per key, so interrupts aren't held off for all of them,
+        // and each key's events are handed over before the next.
+        MFIButtonScanner::lock_();
+        if (changed & bit) {
+            // The state when it changed comes first, a quick press might
+            // already be over.
+            MFIButtonScanner::feed_(key, (captured & bit) != 0, now);
+        }
+        MFIButtonScanner::feed_(key, (current & bit) != 0, now);
+        if (MFIButtonScanner::key_bouncing_(key, now)) {
+            bouncing = true;
+        }
+        MFIButtonScanner::unlock_();
+    }
+    if (bouncing) {
+        // Anything that happened within the debounce time was ignored, and
+        // the chip won't tell us about it again.
+        MFIButtonScanner::lock_();
+        this->schedule_scan_(MFI_BUTTON_EXPANDER_RECHECK, now);
+        MFIButtonScanner::unlock_();
+    }
+}
+
+void MFI_BUTTON_ISR_ATTR MFIButtonExpander::scan_(unsigned long now) {
+    (void)now;
+    // This runs in the timer interrupt, so the read has to wait as well
+    this->request_work_();
+}
+
+bool MFIButtonMCP23x17::init_chip_() {
+    // Mirrored interrupts, sequential access and, for the MCP23S17,
+    // hardware addresses. Until HAEN is set, the MCP23S17 answers to any
+    // address, so this works for it too.
+    const uint8_t iocon = MCP_IOCON_MIRROR | MCP_IOCON_HAEN;
+    const uint8_t all[2] = {0xFF, 0xFF};
+    const uint8_t none[2] = {0x00, 0x00};
+    return this->write_registers_(MCP_IOCON, &iocon, 1) &&
+           this->write_registers_(MCP_IODIR, all, 2) &&
+           this->write_registers_(MCP_GPPU, all, 2) &&
+           // Compare against the previous value, so any change interrupts
+           this->write_registers_(MCP_INTCON, none, 2) &&
+           this->write_registers_(MCP_GPINTEN, all, 2);
+}
+
+bool MFIButtonMCP23x17::read_inputs_(uint16_t *changed, uint16_t *captured,
+                                     uint16_t *current) {
+    // INTF, INTCAP and GPIO are next to each other, so that's one read.
+    // Reading INTCAP clears the interrupt.
+    uint8_t data[6];
+    if (!this->read_registers_(MCP_INTF, data, sizeof(data))) {
+        return false;
+    }
+    *changed = data[0] | (uint16_t)data[1] << 8;
+    *captured = data[2] | (uint16_t)data[3] << 8;
+    *current = data[4] | (uint16_t)data[5] << 8;
+    return true;
+}
+
+bool MFIButtonMCP23017::write_registers_(uint8_t reg, const uint8_t *data,
+                                         uint8_t count) {
+    this->wire_.beginTransmission(this->address_);
+    this->wire_.write(reg);
+    this->wire_.write(data, count);
+    return this->wire_.endTransmission() == 0;
+}
+
+bool MFIButtonMCP23017::read_registers_(uint8_t reg, uint8_t *data,
+                                        uint8_t count) {
+    this->wire_.beginTransmission(this->address_);
+    this->wire_.write(reg);
+    // Repeated start, so no one else gets the bus in between
+    if (this->wire_.endTransmission(false) != 0) {
+        return false;
+    }
+    if (this->wire_.requestFrom(this->address_, count) != count) {
+        return false;
+    }
+    for (uint8_t i = 0; i < count; i++) {
+        data[i] = this->wire_.read();
+    }
+    return true;
+}
+
+bool MFIButtonMCP23S17::init_chip_() {
+    pinMode(this->cs_pin_, OUTPUT);
+    digitalWrite(this->cs_pin_, HIGH);
+    return MFIButtonMCP23x17::init_chip_();
+}
+
+bool MFIButtonMCP23S17::write_registers_(uint8_t reg, const uint8_t *data,
+                                         uint8_t count) {
+    this->spi_.beginTransaction(SPISettings(10000000, MSBFIRST, SPI_MODE0));
+    digitalWrite(this->cs_pin_, LOW);
+    this->spi_.transfer(0x40 | this->address_ << 1);
+    this->spi_.transfer(reg);
+    for (uint8_t i = 0; i < count; i++) {
+        this->spi_.transfer(data[i]);
+    }
+    digitalWrite(this->cs_pin_, HIGH);
+    this->spi_.endTransaction();
+    // SPI has no acknowledge, so there's no way to tell
+    return true;
+}
+
+bool MFIButtonMCP23S17::read_registers_(uint8_t reg, uint8_t *data,
+                                        uint8_t count) {
+    this->spi_.beginTransaction(SPISettings(10000000, MSBFIRST, SPI_MODE0));
+    digitalWrite(this->cs_pin_, LOW);
+    this->spi_.transfer(0x41 | this->address_ << 1);
+    this->spi_.transfer(reg);
+    for (uint8_t i = 0; i < count; i++) {
+        data[i] = this->spi_.transfer(0);
+    }
+    digitalWrite(this->cs_pin_, HIGH);
+    this->spi_.endTransaction();
+    return true;
+}
+
+bool MFIButtonPCF8574::init_chip_() {
+    // Writing a 1 makes a pin an input, with a weak pull-up
+    this->wire_.beginTransmission(this->address_);
+    this->wire_.write((uint8_t)0xFF);
+    return this->wire_.endTransmission() == 0;
+}
+
+bool MFIButtonPCF8574::read_inputs_(uint16_t *changed, uint16_t *captured,
+                                    uint16_t *current) {
+    // Reading clears the interrupt
+    if (this->wire_.requestFrom(this->address_, (uint8_t)1) != 1) {
+        return false;
+    }
+    uint8_t inputs = this->wire_.read();
+    *changed = inputs ^ this->last_inputs_;
+    *captured = inputs;
+    *current = inputs;
+    this->last_inputs_ = inputs;
+    return true;
+}
@@ -0,0 +1,123 @@
+#ifndef _MFIBUTTONEXPANDER_H
+#define _MFIBUTTONEXPANDER_H
+
+#include "MFIButton.h"
+#include <SPI.h>
+#include <Wire.h>
+
+// After a change, the inputs are read again this much later, in case an
+// edge was ignored for being within the debounce time.
+#ifndef MFI_BUTTON_EXPANDER_RECHECK
+#define MFI_BUTTON_EXPANDER_RECHECK (MFI_BUTTON_DEFAULT_DEBOUNCE + 5)
+#endif
+
+// Buttons behind an I2C or SPI port expander. The bus can't be used from an
+// interrupt handler, so the expander's interrupt line only asks for a read,
+// and MFIButton::dispatch() does it: from loop(), or the task started by
+// MFIButton::startDispatchTask(). However many edges happen before then,
+// it's one transaction for the whole chip, and the result is fed to the
+// state machines of all its keys. All inputs on the chip are used for
+// buttons, with pull-ups, pressed when low. The bus has to be started with
+// Wire.begin() or SPI.begin() before begin().
+class MFIButtonExpander : public MFIButtonScanner {
+   public:
+    MFIButton &key(uint8_t input) { return this->keys_[input]; };
+    uint8_t getInputs() { return inputs_; };
+    bool begin();
+    // Number of reads that failed on the bus
+    uint16_t getReadErrorCount() { return read_errors_; };
+
+   protected:
+    MFIButtonExpander(uint8_t inputs, int interrupt_pin);
+    // Sets up all inputs with pull-ups and interrupt on change
+    virtual bool init_chip_() = 0;
+    // Reads the chip in a single transaction. For the inputs set in changed,
+    // captured has their state when the chip raised its interrupt, which can
+    // differ from current for quick presses.
+    virtual bool read_inputs_(uint16_t *changed, uint16_t *captured,
+                              uint16_t *current) = 0;
+    void work_();
+    void scan_(unsigned long now);
+
+   private:
+    static SLIST_CLASS_HEAD(expanders_head_, MFIButtonExpander) expanders_;
+    static void interrupt_handler_();
+
+    uint8_t inputs_;
+    int interrupt_pin_;
+    uint16_t read_errors_ = 0;
+    MFIButton *keys_;
+    SLIST_CLASS_ENTRY(MFIButtonExpander) entries_ = {NULL};
+};
+
+// MCP23017/MCP23S17, 16 inputs. Both interrupt pins are mirrored, so only
+// one interrupt line needs to be connected.
+class MFIButtonMCP23x17 : public MFIButtonExpander {
+   protected:
+    MFIButtonMCP23x17(int interrupt_pin)
+        : MFIButtonExpander(16, interrupt_pin){};
+    bool init_chip_();
+    bool read_inputs_(uint16_t *changed, uint16_t *captured,
+                      uint16_t *current);
+    // Registers are accessed in sequential mode, as A/B pairs
+    virtual bool write_registers_(uint8_t reg, const uint8_t *data,
+                                  uint8_t count) = 0;
+    virtual bool read_registers_(uint8_t reg, uint8_t *data,
+                                 uint8_t count) = 0;
+};
+
+class MFIButtonMCP23017 : public MFIButtonMCP23x17 {
+   public:
+    MFIButtonMCP23017(int interrupt_pin, uint8_t address = 0x20,
+                      TwoWire &wire = Wire)
+        : MFIButtonMCP23x17(interrupt_pin), address_(address), wire_(wire){};
+
+   protected:
+    bool write_registers_(uint8_t reg, const uint8_t *data, uint8_t count);
+    bool read_registers_(uint8_t reg, uint8_t *data, uint8_t count);
+
+   private:
+    uint8_t address_;
+    TwoWire &wire_;
+};
+
+class MFIButtonMCP23S17 : public MFIButtonMCP23x17 {
+   public:
+    MFIButtonMCP23S17(int interrupt_pin, uint8_t cs_pin, uint8_t address = 0,
+                      SPIClass &spi = SPI)
+        : MFIButtonMCP23x17(interrupt_pin),
+          cs_pin_(cs_pin),
+          address_(address),
+          spi_(spi){};
+
+   protected:
+    bool init_chip_();
+    bool write_registers_(uint8_t reg, const uint8_t *data, uint8_t count);
+    bool read_registers_(uint8_t reg, uint8_t *data, uint8_t count);
+
+   private:
+    uint8_t cs_pin_;
+    uint8_t address_;
+    SPIClass &spi_;
+};
+
+// PCF8574/PCF8574A, 8 inputs. It has no capture register, so a press that's
+// already over by the time of the read is missed.
+class MFIButtonPCF8574 : public MFIButtonExpander {
+   public:
+    MFIButtonPCF8574(int interrupt_pin, uint8_t address = 0x20,
+                     TwoWire &wire = Wire)
+        : MFIButtonExpander(8, interrupt_pin), address_(address), wire_(wire){};
+
+   protected:
+    bool init_chip_();
+    bool read_inputs_(uint16_t *changed, uint16_t *captured,
+                      uint16_t *current);
+
+   private:
+    uint8_t address_;
+    uint8_t last_inputs_ = 0xFF;
+    TwoWire &wire_;
+};
+
+#endif  // _MFIBUTTONEXPANDER_H
@@ -0,0 +1,155 @@
+#include "MFIButtonLadder.h"
+
+#if MFI_BUTTON_LADDER
+
+#if defined(__AVR__)
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#endif
+
+MFIButtonLadder *volatile MFIButtonLadder::instance_ = NULL;
+
+MFIButtonLadder::MFIButtonLadder(uint8_t pin, const uint16_t *levels,
+                                 uint8_t count, uint16_t tolerance)
+    : pin_(pin), count_(count), tolerance_(tolerance) {
+    this->levels_ = new uint16_t[count];
+    memcpy(this->levels_, levels, count * sizeof(uint16_t));
+    this->keys_ = MFIButtonScanner::make_keys_(count);
+}
+
+uint8_t MFIButtonLadder::decode_(uint16_t value) {
+    for (uint8_t i = 0; i < this->count_; i++) {
+        uint16_t level = this->levels_[i];
+        if (value + this->tolerance_ >= level &&
+            value <= level + this->tolerance_) {
+            return i;
+        }
+    }
+    return NO_KEY_;
+}
+
+void MFIButtonLadder::sample_(uint16_t value) {
+    uint8_t key = this->decode_(value);
+    if (key == this->key_) {
+        // Nothing changed, which is nearly every sample
+        this->candidate_samples_ = 0;
+        return;
+    }
+    // While the voltage moves between two levels it can pass others, so
+    // only take a new key once it has been read a few times in a row.
+    if (key != this->candidate_) {
+        this->candidate_ = key;
+        this->candidate_samples_ = 0;
+    }
+    if (++this->candidate_samples_ < MFI_BUTTON_LADDER_STABLE_SAMPLES) {
+        return;
+    }
+    this->candidate_samples_ = 0;
+    auto now = MFIButtonScanner::now_();
+    MFIButtonScanner::lock_();
+    this->key_ = key;
+    this->feed_keys_(now);
+    MFIButtonScanner::unlock_();
+}
+
+void MFI_BUTTON_ISR_ATTR MFIButtonLadder::feed_keys_(unsigned long now) {
+    bool bouncing = false;
+    for (uint8_t i = 0; i < this->count_; i++) {
+        MFIButton *key = &this->keys_[i];
+        MFIButtonScanner::feed_(key, i != this->key_, now);
+        if (MFIButtonScanner::key_bouncing_(key, now)) {
+            bouncing = true;
+        }
+    }
+    if (bouncing) {
+        // A change within the debounce time was ignored, so feed the keys
+        // again once it's over.
+        this->schedule_scan_(MFI_BUTTON_DEFAULT_DEBOUNCE + 1, now);
+    }
+}
+
+void MFI_BUTTON_ISR_ATTR MFIButtonLadder::scan_(unsigned long now) {
+    this->feed_keys_(now);
+}
+
+#if defined(__AVR__)
+
+void mfi_ladder_sample(uint16_t value) {
+    MFIButtonLadder *ladder = MFIButtonLadder::instance_;
+    if (ladder != NULL) {
+        ladder->sample_(value);
+    }
+}
+
+ISR(ADC_vect) {
+    mfi_ladder_sample(ADC);
+}
+
+bool MFIButtonLadder::begin() {
+    if (MFIButtonLadder::instance_ != NULL) {
+        return false;
+    }
+#ifdef analogPinToChannel
+    uint8_t channel = analogPinToChannel(this->pin_);
+#else
+    uint8_t channel = this->pin_ >= A0 ? this->pin_ - A0 : this->pin_;
+#endif
+    MFIButtonScanner::init_timers_();
+    MFIButtonLadder::instance_ = this;
+    uint8_t sreg = SREG;
+    cli();
+    // AVcc reference, free running, interrupt on every conversion, /128
+    ADMUX = _BV(REFS0) | (channel & 0x07);
+#ifdef MUX5
+    ADCSRB = (channel & 0x08) ? _BV(MUX5) : 0;
+#else
+    ADCSRB = 0;
+#endif
+    ADCSRA = _BV(ADEN) | _BV(ADSC) | _BV(ADATE) | _BV(ADIE) | _BV(ADPS2) |
+             _BV(ADPS1) | _BV(ADPS0);
+    SREG = sreg;
+    return true;
+}
+
+#else
+
+void MFI_BUTTON_ISR_ATTR MFIButtonLadder::frame_done_() {
+    // This is the ADC interrupt, the frame is read by dispatch()
+    MFIButtonLadder *ladder = MFIButtonLadder::instance_;
+    if (ladder != NULL) {
+        ladder->request_work_();
+    }
+}
+
+void MFIButtonLadder::work_() {
+    adc_continuous_data_t *result = NULL;
+    if (analogContinuousRead(&result, 0) && result != NULL) {
+        this->sample_(result[0].avg_read_raw);
+    }
+}
+
+bool MFIButtonLadder::begin() {
+    if (MFIButtonLadder::instance_ != NULL) {
+        return false;
+    }
+    const uint32_t rate = SOC_ADC_SAMPLE_FREQ_THRES_LOW;
+    uint32_t conversions = rate / MFI_BUTTON_LADDER_FRAMES_PER_SECOND;
+    if (conversions == 0) {
+        conversions = 1;
+    }
+    MFIButtonScanner::init_timers_();
+    this->enable_work_();
+    MFIButtonLadder::instance_ = this;
+    const uint8_t pins[1] = {this->pin_};
+    if (!analogContinuous(pins, 1, conversions, rate,
+                          MFIButtonLadder::frame_done_) ||
+        !analogContinuousStart()) {
+        MFIButtonLadder::instance_ = NULL;
+        return false;
+    }
+    return true;
+}
+
+#endif
+
+#endif  // MFI_BUTTON_LADDER
@@ -0,0 +1,76 @@
+#ifndef _MFIBUTTONLADDER_H
+#define _MFIBUTTONLADDER_H
+
+#include "MFIButton.h"
+
+// Set to 1 for MFIButtonLadder. It takes over the ADC, so analogRead() can't
+// be used along with it, and on AVR it defines the ADC interrupt vector.
+#ifndef MFI_BUTTON_LADDER
+#define MFI_BUTTON_LADDER 0
+#endif
+
+#if MFI_BUTTON_LADDER
+
+#if defined(__AVR__)
+// About 0.8ms at the 9.6kHz free running rate
+#define MFI_BUTTON_LADDER_STABLE_SAMPLES 8
+#elif defined(ESP32) && defined(ESP_ARDUINO_VERSION_MAJOR) && \
+    ESP_ARDUINO_VERSION_MAJOR >= 3 && SOC_ADC_DMA_SUPPORTED
+// Each sample is the average of a 5ms frame
+#define MFI_BUTTON_LADDER_STABLE_SAMPLES 2
+#define MFI_BUTTON_LADDER_FRAMES_PER_SECOND 200
+#else
+#error "MFI_BUTTON_LADDER needs AVR, or ESP32 with Arduino core 3 or later"
+#endif
+
+// Buttons on a resistor ladder, all on one ADC pin. The ADC samples the pin
+// continuously in the background: free running with its interrupt on AVR,
+// continuous (DMA) mode on ESP32. Samples are only decoded to check they're
+// still on the same button, so the state machine of a key is only fed when
+// the reading moves to another button, and stays there for
+// MFI_BUTTON_LADDER_STABLE_SAMPLES samples. Only one button is seen at a
+// time, and there can only be one ladder.
+class MFIButtonLadder : public MFIButtonScanner {
+   public:
+    // levels are the raw ADC readings for each button, 10 bits on AVR and
+    // 12 bits on ESP32. A reading within tolerance of a level counts as that
+    // button, anything else as no button.
+    MFIButtonLadder(uint8_t pin, const uint16_t *levels, uint8_t count,
+                    uint16_t tolerance);
+    MFIButton &key(uint8_t index) { return this->keys_[index]; };
+    uint8_t getKeys() { return count_; };
+    bool begin();
+
+   protected:
+    void scan_(unsigned long now);
+#if !defined(__AVR__)
+    void work_();
+#endif
+
+   private:
+    static const uint8_t NO_KEY_ = 0xFF;
+    static MFIButtonLadder *volatile instance_;
+#if defined(__AVR__)
+    friend void mfi_ladder_sample(uint16_t value);
+#else
+    static void frame_done_();
+#endif
+    uint8_t decode_(uint16_t value);
+    // Runs for every sample, has to be quick
+    void sample_(uint16_t value);
+    // Feeds the current key to all keys, with the lock held
+    void feed_keys_(unsigned long now);
+
+    uint8_t pin_;
+    uint8_t count_;
+    uint16_t tolerance_;
+    uint16_t *levels_;
+    MFIButton *keys_;
+    uint8_t key_ = NO_KEY_;
+    uint8_t candidate_ = NO_KEY_;
+    uint8_t candidate_samples_ = 0;
+};
+
+#endif  // MFI_BUTTON_LADDER
+
+#endif  // _MFIBUTTONLADDER_H
@@ -0,0 +1,116 @@
+#include "MFIButtonMatrix.h"
+
+struct MFIButtonMatrix::matrices_head_ MFIButtonMatrix::matrices_ =
+    SLIST_HEAD_INITIALIZER(matrices_);
+
+MFIButtonMatrix::MFIButtonMatrix(const uint8_t *row_pins, uint8_t rows,
+                                 const uint8_t *column_pins, uint8_t columns,
+                                 int interrupt_pin)
+    : rows_(rows), columns_(columns), interrupt_pin_(interrupt_pin) {
+    // Copy the pins, so they don't have to stay around
+    this->row_pins_ = new uint8_t[rows];
+    memcpy(this->row_pins_, row_pins, rows);
+    this->column_pins_ = new uint8_t[columns];
+    memcpy(this->column_pins_, column_pins, columns);
+    this->keys_ = MFIButtonScanner::make_keys_(rows * columns);
+}
+
+bool MFIButtonMatrix::begin() {
+    // Check all the interrupts before touching anything
+    if (this->interrupt_pin_ >= 0) {
+        if (digitalPinToInterrupt(this->interrupt_pin_) == NOT_AN_INTERRUPT) {
+            return false;
+        }
+    } else {
+        for (uint8_t c = 0; c < this->columns_; c++) {
+            if (digitalPinToInterrupt(this->column_pins_[c]) ==
+                NOT_AN_INTERRUPT) {
+                return false;
+            }
+        }
+    }
+    MFIButtonScanner::init_timers_();
+    for (uint8_t c = 0; c < this->columns_; c++) {
+        pinMode(this->column_pins_[c], INPUT_PULLUP);
+    }
+    for (uint8_t r = 0; r < this->rows_; r++) {
+#ifdef OUTPUT_OPEN_DRAIN
+        // Switching the level is cheaper than switching the mode
+        pinMode(this->row_pins_[r], OUTPUT_OPEN_DRAIN);
+#endif
+        this->select_row_(r, true);
+    }
+    MFIButtonScanner::lock_();
+    SLIST_INSERT_HEAD(&matrices_, this, entries_);
+    MFIButtonScanner::unlock_();
+    if (this->interrupt_pin_ >= 0) {
+        pinMode(this->interrupt_pin_, INPUT_PULLUP);
+        MFIButtonScanner::attach_interrupt_(
+            digitalPinToInterrupt(this->interrupt_pin_),
+            MFIButtonMatrix::column_interrupt_handler_, FALLING);
+    } else {
+        for (uint8_t c = 0; c < this->columns_; c++) {
+            MFIButtonScanner::attach_interrupt_(
+                digitalPinToInterrupt(this->column_pins_[c]),
+                MFIButtonMatrix::column_interrupt_handler_, FALLING);
+        }
+    }
+    // Pick up any keys that are already down
+    this->wake_();
+    return true;
+}
+
+void MFI_BUTTON_ISR_ATTR MFIButtonMatrix::column_interrupt_handler_() {
+    // There are very few matrices, so just wake them all. Ones that are
+    // already scanning ignore it, the others go back to sleep after a scan
+    // if none of their keys are down.
+    MFIButtonMatrix *matrix;
+    SLIST_FOREACH(matrix, &matrices_, entries_) {
+        matrix->wake_();
+    }
+}
+
+void MFI_BUTTON_ISR_ATTR MFIButtonMatrix::select_row_(uint8_t row,
+                                                      bool selected) {
+    // Unselected rows float instead of driving high, so that two keys in one
+    // column never short a high row to a low one.
+#ifdef OUTPUT_OPEN_DRAIN
+    digitalWrite(this->row_pins_[row], selected ? LOW : HIGH);
+#else
+    if (selected) {
+        digitalWrite(this->row_pins_[row], LOW);
+        pinMode(this->row_pins_[row], OUTPUT);
+    } else {
+        pinMode(this->row_pins_[row], INPUT);
+    }
+#endif
+}
+
+void MFI_BUTTON_ISR_ATTR MFIButtonMatrix::scan_(unsigned long now) {
+    bool busy = false;
+    for (uint8_t r = 0; r < this->rows_; r++) {
+        this->select_row_(r, false);
+    }
+    MFIButton *key = this->keys_;
+    for (uint8_t r = 0; r < this->rows_; r++) {
+        this->select_row_(r, true);
+        delayMicroseconds(MFI_BUTTON_MATRIX_SETTLE_US);
+        for (uint8_t c = 0; c < this->columns_; c++, key++) {
+            MFIButtonScanner::feed_(
+                key, digitalRead(this->column_pins_[c]) == HIGH, now);
+            if (MFIButtonScanner::key_busy_(key, now)) {
+                busy = true;
+            }
+        }
+        this->select_row_(r, false);
+    }
+    if (busy &&
+        this->schedule_scan_(MFI_BUTTON_MATRIX_SCAN_INTERVAL, now)) {
+        return;
+    }
+    // Back to waiting for a column interrupt. A key that is down when the
+    // rows go low makes its own falling edge, so it isn't missed.
+    for (uint8_t r = 0; r < this->rows_; r++) {
+        this->select_row_(r, true);
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef _MFIBUTTONMATRIX_H
+#define _MFIBUTTONMATRIX_H
+
+#include "MFIButton.h"
+
+// How often the keys are read while any of them is pressed or bouncing
+#ifndef MFI_BUTTON_MATRIX_SCAN_INTERVAL
+#define MFI_BUTTON_MATRIX_SCAN_INTERVAL 5
+#endif
+// Time for a column to follow its row after the row is selected
+#ifndef MFI_BUTTON_MATRIX_SETTLE_US
+#define MFI_BUTTON_MATRIX_SETTLE_US 5
+#endif
+
+// A key matrix, with the columns pulled up and the rows pulling them low.
+// While no key is pressed all rows are driven low, so any press pulls a
+// column low and its interrupt starts scanning. Scanning runs on the timer
+// queue, every MFI_BUTTON_MATRIX_SCAN_INTERVAL ms, and stops again when all
+// keys are released. Each key is an MFIButton, so it has all the same
+// handlers. Without diodes, three keys pressed in a rectangle show up as a
+// fourth.
+class MFIButtonMatrix : public MFIButtonScanner {
+   public:
+    // If the columns are combined into a single interrupt line, pass its
+    // pin. Otherwise every column pin needs to support interrupts.
+    MFIButtonMatrix(const uint8_t *row_pins, uint8_t rows,
+                    const uint8_t *column_pins, uint8_t columns,
+                    int interrupt_pin = -1);
+    MFIButton &key(uint8_t row, uint8_t column) {
+        return this->keys_[row * this->columns_ + column];
+    };
+    bool begin();
+    uint8_t getRows() { return rows_; };
+    uint8_t getColumns() { return columns_; };
+
+   protected:
+    void scan_(unsigned long now);
+
+   private:
+    static SLIST_CLASS_HEAD(matrices_head_, MFIButtonMatrix) matrices_;
+    static void column_interrupt_handler_();
+    void select_row_(uint8_t row, bool selected);
+
+    uint8_t *row_pins_;
+    uint8_t *column_pins_;
+    uint8_t rows_;
+    uint8_t columns_;
+    int interrupt_pin_;
+    MFIButton *keys_;
+    SLIST_CLASS_ENTRY(MFIButtonMatrix) entries_ = {NULL};
+};
+
+#endif  // _MFIBUTTONMATRIX_H
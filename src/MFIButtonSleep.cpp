@@ -0,0 +1,126 @@
+// Sleeping until a button is pressed. This is only done when idle, so there
+// are no timers pending and no deadline has to survive the sleep. That
+// matters on AVR, where millis() stops in power down: time just seems to
+// skip the sleep. On ESP32 millis() is kept right through light sleep.
+#include "MFIButton.h"
+
+#if MFI_BUTTON_SLEEP
+
+#if defined(ESP32)
+#include "esp_sleep.h"
+#elif defined(__AVR__)
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#endif
+
+#if defined(ESP32)
+
+bool MFIButton::sleep() {
+    if (!MFIButton::isIdle()) {
+        return false;
+    }
+    // GPIO wakeup needs a level, and switches the pin interrupt to that
+    // level too. Turn the interrupt off, so that it doesn't keep firing
+    // while the button is held after waking up.
+    MFIButton *button;
+    SLIST_FOREACH(button, &started_buttons_, started_entries_) {
+        gpio_num_t pin = (gpio_num_t)button->pin_;
+        gpio_intr_disable(pin);
+        gpio_wakeup_enable(pin, button->inverted_ ? GPIO_INTR_HIGH_LEVEL
+                                                  : GPIO_INTR_LOW_LEVEL);
+    }
+    esp_sleep_enable_gpio_wakeup();
+    // A press since isIdle() means the level is already there, so this
+    // returns right away.
+    esp_light_sleep_start();
+    SLIST_FOREACH(button, &started_buttons_, started_entries_) {
+        gpio_num_t pin = (gpio_num_t)button->pin_;
+        gpio_wakeup_disable(pin);
+        gpio_set_intr_type(pin, GPIO_INTR_ANYEDGE);
+        gpio_intr_enable(pin);
+    }
+    // The press that woke us up never got an interrupt
+    MFIButton::check_all_buttons_();
+    return true;
+}
+
+#elif defined(__AVR__)
+
+// INT0/INT1 only wake from power down on a level, so pin change interrupts
+// do the waking. The button logic runs after sleep_cpu() returns.
+#ifdef PCINT0_vect
+EMPTY_INTERRUPT(PCINT0_vect);
+#endif
+#ifdef PCINT1_vect
+EMPTY_INTERRUPT(PCINT1_vect);
+#endif
+#ifdef PCINT2_vect
+EMPTY_INTERRUPT(PCINT2_vect);
+#endif
+#ifdef PCINT3_vect
+EMPTY_INTERRUPT(PCINT3_vect);
+#endif
+
+bool MFIButton::sleep() {
+    // Put the pin change registers back as they were afterwards
+    uint8_t pcicr = PCICR;
+#ifdef PCMSK0
+    uint8_t pcmsk0 = PCMSK0;
+#endif
+#ifdef PCMSK1
+    uint8_t pcmsk1 = PCMSK1;
+#endif
+#ifdef PCMSK2
+    uint8_t pcmsk2 = PCMSK2;
+#endif
+#ifdef PCMSK3
+    uint8_t pcmsk3 = PCMSK3;
+#endif
+    MFIButton *button;
+    SLIST_FOREACH(button, &started_buttons_, started_entries_) {
+        // Pins without a pin change interrupt can't wake us up
+        volatile uint8_t *pcmsk = digitalPinToPCMSK(button->pin_);
+        if (pcmsk != NULL) {
+            *pcmsk |= _BV(digitalPinToPCMSKbit(button->pin_));
+            PCICR |= _BV(digitalPinToPCICRbit(button->pin_));
+        }
+    }
+    set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+    bool slept = false;
+    noInterrupts();
+    // With interrupts off, no press can get in between this check and
+    // sleeping. The instruction after sei always runs before any interrupt.
+    if (MFIButton::isIdle()) {
+        sleep_enable();
+        interrupts();
+        sleep_cpu();
+        sleep_disable();
+        slept = true;
+    } else {
+        interrupts();
+    }
+    noInterrupts();
+#ifdef PCMSK0
+    PCMSK0 = pcmsk0;
+#endif
+#ifdef PCMSK1
+    PCMSK1 = pcmsk1;
+#endif
+#ifdef PCMSK2
+    PCMSK2 = pcmsk2;
+#endif
+#ifdef PCMSK3
+    PCMSK3 = pcmsk3;
+#endif
+    PCICR = pcicr;
+    interrupts();
+    if (slept) {
+        // The external interrupts don't see edges while the clock is stopped
+        MFIButton::check_all_buttons_();
+    }
+    return slept;
+}
+
+#endif
+
+#endif  // MFI_BUTTON_SLEEP
@@ -0,0 +1,269 @@
+// Built-in hardware timers, so that users don't need to write their own
+// timer callback. Each of these programs a one-shot deadline with as few
+// register writes as the hardware allows, and calls
+// MFIButton::timerInterruptHandler() straight from the interrupt. Deadlines
+// beyond what the timer can count are clamped, the handler then finds
+// nothing expired and sets the timer again for the rest.
+#include "MFIButton.h"
+
+#if MFI_BUTTON_BUILTIN_TIMER
+
+#if defined(ESP32)
+#include "esp_timer.h"
+#elif defined(ARDUINO_ARCH_RP2040)
+#include "hardware/timer.h"
+#elif defined(__AVR__)
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#endif
+
+#ifndef MFI_BUTTON_AVR_TIMER
+#define MFI_BUTTON_AVR_TIMER 1
+#endif
+
+// Converts ticks of MFI_BUTTON_TICKS() to microseconds
+static uint32_t MFI_BUTTON_ISR_ATTR mfi_ticks_to_us(unsigned long ticks) {
+#if MFI_BUTTON_TICKS_PER_MS == 1000
+    return ticks;
+#elif MFI_BUTTON_TICKS_PER_MS == 1
+    return ticks * 1000UL;
+#else
+    return (uint64_t)ticks * 1000 / MFI_BUTTON_TICKS_PER_MS;
+#endif
+}
+
+#if defined(ESP32)
+
+static esp_timer_handle_t mfi_timer = NULL;
+
+static void MFI_BUTTON_ISR_ATTR mfi_timer_callback(void *arg) {
+    (void)arg;
+    MFIButton::timerInterruptHandler();
+}
+
+static void MFI_BUTTON_ISR_ATTR mfi_set_timer(unsigned long ticks) {
+    // Starting a running timer fails, and it doesn't matter if it wasn't
+    // running.
+    esp_timer_stop(mfi_timer);
+    esp_timer_start_once(mfi_timer, mfi_ticks_to_us(ticks));
+}
+
+bool MFIButton::useBuiltinTimer() {
+    if (mfi_timer == NULL) {
+        esp_timer_create_args_t args = {};
+        args.callback = mfi_timer_callback;
+#ifdef CONFIG_ESP_TIMER_SUPPORTS_ISR_DISPATCH_METHOD
+        args.dispatch_method = ESP_TIMER_ISR;
+#else
+        // Without ISR dispatch the handler runs in the esp_timer task
+        args.dispatch_method = ESP_TIMER_TASK;
+#endif
+        args.name = "MFIButton";
+        if (esp_timer_create(&args, &mfi_timer) != ESP_OK) {
+            return false;
+        }
+    }
+    MFIButton::setInterruptTimerTickCallback(mfi_set_timer);
+    return true;
+}
+
+#elif defined(ARDUINO_ARCH_RP2040)
+
+static int mfi_alarm = -1;
+
+static void MFI_BUTTON_ISR_ATTR mfi_alarm_callback(uint alarm) {
+    (void)alarm;
+    MFIButton::timerInterruptHandler();
+}
+
+static void MFI_BUTTON_ISR_ATTR mfi_set_timer(unsigned long ticks) {
+    // The alarm compares against the 64-bit microsecond timer, so this is a
+    // single register write.
+    absolute_time_t target = make_timeout_time_us(mfi_ticks_to_us(ticks));
+    if (hardware_alarm_set_target(mfi_alarm, target)) {
+        // Already in the past, fire as soon as we return
+        hardware_alarm_force_irq(mfi_alarm);
+    }
+}
+
+bool MFIButton::useBuiltinTimer() {
+    if (mfi_alarm < 0) {
+        mfi_alarm = hardware_alarm_claim_unused(false);
+        if (mfi_alarm < 0) {
+            return false;
+        }
+        hardware_alarm_set_callback(mfi_alarm, mfi_alarm_callback);
+    }
+    MFIButton::setInterruptTimerTickCallback(mfi_set_timer);
+    return true;
+}
+
+#elif defined(__AVR__)
+
+// With the /1024 prescaler, one count is this many microseconds. That's 64
+// at 16MHz, so Timer1 reaches about 4 seconds and Timer2 about 16ms.
+#define MFI_AVR_TIMER_US (1024000000UL / F_CPU)
+
+// Counts from now to the compare value. The prescaler is somewhere in the
+// current count, so that one doesn't count, and at least 2 are needed for
+// the counter not to step past the compare value while it's written.
+static uint32_t mfi_avr_counts(unsigned long ticks, uint32_t max) {
+    uint32_t us = mfi_ticks_to_us(ticks);
+    if (us >= (max - 1) * MFI_AVR_TIMER_US) {
+        return max;
+    }
+    // Round up, never fire early
+    uint32_t counts = (us + MFI_AVR_TIMER_US - 1) / MFI_AVR_TIMER_US + 1;
+    return counts < 2 ? 2 : counts;
+}
+
+#if MFI_BUTTON_AVR_TIMER == 1
+
+static void mfi_set_timer(unsigned long ticks) {
+    // The counter runs freely, so just move the compare value
+    uint16_t counts = (uint16_t)mfi_avr_counts(ticks, 0xFFFF);
+    for (;;) {
+        uint16_t start = TCNT1;
+        OCR1A = start + counts;
+        TIFR1 = _BV(OCF1A);
+        TIMSK1 |= _BV(OCIE1A);
+        // If an interrupt held us up past the compare value, the match is
+        // gone, and the flag can't be set from software. So go again, for as
+        // soon as possible.
+        if ((uint16_t)(TCNT1 - start) < counts || (TIFR1 & _BV(OCF1A))) {
+            return;
+        }
+        counts = 2;
+    }
+}
+
+ISR(TIMER1_COMPA_vect) {
+    TIMSK1 &= ~_BV(OCIE1A);
+    MFIButton::timerInterruptHandler();
+}
+
+bool MFIButton::useBuiltinTimer() {
+    uint8_t sreg = SREG;
+    cli();
+    // Normal mode, /1024. This takes PWM away from the Timer1 pins.
+    TCCR1A = 0;
+    TCCR1B = _BV(CS12) | _BV(CS10);
+    TIMSK1 = 0;
+    SREG = sreg;
+    MFIButton::setInterruptTimerTickCallback(mfi_set_timer);
+    return true;
+}
+
+#elif MFI_BUTTON_AVR_TIMER == 2
+
+static void mfi_set_timer(unsigned long ticks) {
+    uint8_t counts = (uint8_t)mfi_avr_counts(ticks, 0xFF);
+    for (;;) {
+        uint8_t start = TCNT2;
+        OCR2A = start + counts;
+        TIFR2 = _BV(OCF2A);
+        TIMSK2 |= _BV(OCIE2A);
+        // Missed, see Timer1
+        if ((uint8_t)(TCNT2 - start) < counts || (TIFR2 & _BV(OCF2A))) {
+            return;
+        }
+        counts = 2;
+    }
+}
+
+ISR(TIMER2_COMPA_vect) {
+    TIMSK2 &= ~_BV(OCIE2A);
+    MFIButton::timerInterruptHandler();
+}
+
+bool MFIButton::useBuiltinTimer() {
+    uint8_t sreg = SREG;
+    cli();
+    // Normal mode, /1024. This takes PWM and tone() away from Timer2.
+    TCCR2A = 0;
+    TCCR2B = _BV(CS22) | _BV(CS21) | _BV(CS20);
+    TIMSK2 = 0;
+    SREG = sreg;
+    MFIButton::setInterruptTimerTickCallback(mfi_set_timer);
+    return true;
+}
+
+#else
+#error "MFI_BUTTON_AVR_TIMER must be 1 or 2"
+#endif
+
+#elif defined(ARDUINO_ARCH_SAMD) && !defined(__SAMD51__)
+
+// TC3 at 48MHz/1024 counts in steps of about 21us, up to about 1.4 seconds
+#define MFI_SAMD_TIMER_HZ (F_CPU / 1024)
+
+static void mfi_tc3_sync() {
+    while (TC3->COUNT16.STATUS.bit.SYNCBUSY) {
+    }
+}
+
+// The count has to be synchronized before it can be read
+static uint16_t mfi_tc3_count() {
+    TC3->COUNT16.READREQ.reg = TC_READREQ_RREQ | TC_READREQ_ADDR(0x10);
+    mfi_tc3_sync();
+    return TC3->COUNT16.COUNT.reg;
+}
+
+static void mfi_set_timer(unsigned long ticks) {
+    uint32_t us = mfi_ticks_to_us(ticks);
+    uint16_t counts = 0xFFFF;
+    if (us < 0xFFFEUL * 1000000UL / MFI_SAMD_TIMER_HZ) {
+        // Round up, and one more for the prescaler phase, like on AVR. The
+        // compare value also takes a few clocks to synchronize, so at least
+        // 2 keep the counter from stepping past it meanwhile.
+        counts = ((uint64_t)us * MFI_SAMD_TIMER_HZ + 999999) / 1000000 + 1;
+        if (counts < 2) {
+            counts = 2;
+        }
+    }
+    for (;;) {
+        uint16_t start = mfi_tc3_count();
+        TC3->COUNT16.CC[0].reg = start + counts;
+        mfi_tc3_sync();
+        TC3->COUNT16.INTFLAG.reg = TC_INTFLAG_MC0;
+        TC3->COUNT16.INTENSET.reg = TC_INTENSET_MC0;
+        // Held up past the compare value, so the match is gone. Go again,
+        // for as soon as possible.
+        if ((uint16_t)(mfi_tc3_count() - start) < counts ||
+            TC3->COUNT16.INTFLAG.bit.MC0) {
+            return;
+        }
+        counts = 2;
+    }
+}
+
+void TC3_Handler() {
+    TC3->COUNT16.INTENCLR.reg = TC_INTENCLR_MC0;
+    TC3->COUNT16.INTFLAG.reg = TC_INTFLAG_MC0;
+    MFIButton::timerInterruptHandler();
+}
+
+bool MFIButton::useBuiltinTimer() {
+    GCLK->CLKCTRL.reg = (uint16_t)(GCLK_CLKCTRL_CLKEN | GCLK_CLKCTRL_GEN_GCLK0 |
+                                   GCLK_CLKCTRL_ID_TCC2_TC3);
+    while (GCLK->STATUS.bit.SYNCBUSY) {
+    }
+    TC3->COUNT16.CTRLA.reg &= ~TC_CTRLA_ENABLE;
+    mfi_tc3_sync();
+    // Free running 16-bit counter, compare channel 0 is the deadline
+    TC3->COUNT16.CTRLA.reg = TC_CTRLA_MODE_COUNT16 | TC_CTRLA_WAVEGEN_NFRQ |
+                             TC_CTRLA_PRESCALER_DIV1024;
+    mfi_tc3_sync();
+    TC3->COUNT16.INTENCLR.reg = TC_INTENCLR_MC0;
+    NVIC_EnableIRQ(TC3_IRQn);
+    TC3->COUNT16.CTRLA.reg |= TC_CTRLA_ENABLE;
+    mfi_tc3_sync();
+    MFIButton::setInterruptTimerTickCallback(mfi_set_timer);
+    return true;
+}
+
+#else
+#error "MFI_BUTTON_BUILTIN_TIMER is not supported on this platform"
+#endif
+
+#endif  // MFI_BUTTON_BUILTIN_TIMER
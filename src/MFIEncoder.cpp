@@ -0,0 +1,275 @@
+#include "MFIEncoder.h"
+
+#if MFI_BUTTON_ENCODER_PCNT
+// The counter is 16 bits. It's cleared whenever the knob stops on a
+// detent, and accumulated in software past these, so they hardly matter.
+static const int MFI_ENCODER_PCNT_LIMIT = 32767;
+// Shorter pulses are noise, real edges are far apart even spun by hand
+static const uint32_t MFI_ENCODER_GLITCH_NS = 1000;
+#else
+// Indexed by the previous and current state of A and B, with A the high bit.
+// Positive when A leads B, 0 for no change, or for both pins changing,
+// where an edge was missed and the direction is unknown. The interrupt
+// handler can't read flash on ESP32, and DRAM_ATTR keeps it out of there.
+#if MFI_BUTTON_ISR_IN_RAM && defined(ESP32)
+#define MFI_ENCODER_TABLE_ATTR DRAM_ATTR
+#else
+#define MFI_ENCODER_TABLE_ATTR
+#endif
+static const int8_t MFI_ENCODER_TABLE_ATTR mfi_encoder_transitions[16] = {
+    0, -1, 1, 0, 1, 0, 0, -1, -1, 0, 0, 1, 0, 1, -1, 0,
+};
+
+struct MFIEncoder::encoders_head_ MFIEncoder::encoders_ =
+    SLIST_HEAD_INITIALIZER(encoders_);
+#endif
+
+MFIEncoder::MFIEncoder(uint8_t pin_a, uint8_t pin_b, int switch_pin,
+                       uint8_t steps)
+    : pin_a_(pin_a),
+      pin_b_(pin_b),
+      steps_(steps),
+      switch_(switch_pin >= 0),
+      button_(switch_pin) {}
+
+void MFIEncoder::onTurn(event_callback_t callback) {
+    this->on_turn_ = callback;
+}
+
+void MFIEncoder::setAcceleration(uint8_t factor) {
+    this->acceleration_ = factor;
+}
+
+int32_t MFIEncoder::getPosition() {
+    MFIButtonScanner::lock_();
+    int32_t position = this->position_;
+    MFIButtonScanner::unlock_();
+    return position;
+}
+
+void MFI_BUTTON_ISR_ATTR MFIEncoder::send_turn_(unsigned long now) {
+    int16_t detents = this->pending_;
+    if (detents == 0) {
+        return;
+    }
+    this->pending_ = 0;
+    this->position_ += detents;
+    int16_t steps = detents;
+    if (this->acceleration_ > 1) {
+        // The speed since the last event. After a pause, that's slow anyway.
+        unsigned long ms = (now - this->last_turn_) / MFI_BUTTON_TICKS_PER_MS;
+        if (ms == 0) {
+            ms = 1;
+        }
+        unsigned long magnitude = detents < 0 ? -detents : detents;
+        unsigned long factor =
+            1 + magnitude * 1000 / ms / MFI_BUTTON_ENCODER_ACCEL_RATE;
+        if (factor > this->acceleration_) {
+            factor = this->acceleration_;
+        }
+        steps = detents * (int16_t)factor;
+    }
+    this->last_turn_ = now;
+    if (this->on_turn_ != NULL) {
+        MFIButtonScanner::emit_(
+            this->on_turn_,
+            MFIButtonEvent(MFIButtonEvent::TURN, &this->button_,
+                           (uint16_t)steps));
+    }
+}
+
+#if MFI_BUTTON_ENCODER_PCNT
+
+bool MFIEncoder::begin() {
+    if (this->switch_ && !this->button_.begin()) {
+        return false;
+    }
+    MFIButtonScanner::init_timers_();
+    this->enable_work_();
+    // The pulse counter doesn't set up the pulls
+    pinMode(this->pin_a_, INPUT_PULLUP);
+    pinMode(this->pin_b_, INPUT_PULLUP);
+
+    pcnt_unit_config_t unit_config = {};
+    unit_config.low_limit = -MFI_ENCODER_PCNT_LIMIT;
+    unit_config.high_limit = MFI_ENCODER_PCNT_LIMIT;
+    unit_config.flags.accum_count = 1;
+    if (pcnt_new_unit(&unit_config, &this->unit_) != ESP_OK) {
+        return false;
+    }
+    pcnt_glitch_filter_config_t filter_config = {};
+    filter_config.max_glitch_ns = MFI_ENCODER_GLITCH_NS;
+    // Every edge of both pins counts, with the direction from the other pin
+    pcnt_chan_config_t a_config = {};
+    a_config.edge_gpio_num = this->pin_a_;
+    a_config.level_gpio_num = this->pin_b_;
+    pcnt_chan_config_t b_config = {};
+    b_config.edge_gpio_num = this->pin_b_;
+    b_config.level_gpio_num = this->pin_a_;
+    pcnt_channel_handle_t a_channel = NULL;
+    pcnt_channel_handle_t b_channel = NULL;
+    pcnt_event_callbacks_t callbacks = {};
+    callbacks.on_reach = MFIEncoder::watch_reached_;
+    const int steps = this->steps_;
+    bool ok =
+        pcnt_unit_set_glitch_filter(this->unit_, &filter_config) == ESP_OK &&
+        pcnt_new_channel(this->unit_, &a_config, &a_channel) == ESP_OK &&
+        pcnt_new_channel(this->unit_, &b_config, &b_channel) == ESP_OK &&
+        pcnt_channel_set_edge_action(a_channel,
+                                     PCNT_CHANNEL_EDGE_ACTION_DECREASE,
+                                     PCNT_CHANNEL_EDGE_ACTION_INCREASE) ==
+            ESP_OK &&
+        pcnt_channel_set_level_action(a_channel,
+                                      PCNT_CHANNEL_LEVEL_ACTION_KEEP,
+                                      PCNT_CHANNEL_LEVEL_ACTION_INVERSE) ==
+            ESP_OK &&
+        pcnt_channel_set_edge_action(b_channel,
+                                     PCNT_CHANNEL_EDGE_ACTION_INCREASE,
+                                     PCNT_CHANNEL_EDGE_ACTION_DECREASE) ==
+            ESP_OK &&
+        pcnt_channel_set_level_action(b_channel,
+                                      PCNT_CHANNEL_LEVEL_ACTION_KEEP,
+                                      PCNT_CHANNEL_LEVEL_ACTION_INVERSE) ==
+            ESP_OK &&
+        // The first detent either way wakes us up. The limits have to be
+        // watch points too, for the count to be accumulated past them.
+        pcnt_unit_add_watch_point(this->unit_, steps) == ESP_OK &&
+        pcnt_unit_add_watch_point(this->unit_, -steps) == ESP_OK &&
+        pcnt_unit_add_watch_point(this->unit_, MFI_ENCODER_PCNT_LIMIT) ==
+            ESP_OK &&
+        pcnt_unit_add_watch_point(this->unit_, -MFI_ENCODER_PCNT_LIMIT) ==
+            ESP_OK &&
+        pcnt_unit_register_event_callbacks(this->unit_, &callbacks, this) ==
+            ESP_OK &&
+        pcnt_unit_enable(this->unit_) == ESP_OK &&
+        pcnt_unit_clear_count(this->unit_) == ESP_OK &&
+        pcnt_unit_start(this->unit_) == ESP_OK;
+    return ok;
+}
+
+bool MFI_BUTTON_ISR_ATTR MFIEncoder::watch_reached_(
+    pcnt_unit_handle_t unit, const pcnt_watch_event_data_t *data,
+    void *context) {
+    (void)unit;
+    (void)data;
+    static_cast<MFIEncoder *>(context)->request_work_();
+    return false;
+}
+
+void MFIEncoder::work_() {
+    int count = 0;
+    if (pcnt_unit_get_count(this->unit_, &count) != ESP_OK) {
+        return;
+    }
+    int detents = (count - this->count_) / this->steps_;
+    this->count_ += detents * this->steps_;
+    bool turning = count != this->last_count_;
+    this->last_count_ = count;
+    if (!turning) {
+        // Stopped, which is on a detent, so start from 0 there for the
+        // watch points to work again. Wherever it rests counts as the
+        // detent: an edge lost while clearing, or to bounce, would otherwise
+        // keep the count off from the detents for good.
+        pcnt_unit_clear_count(this->unit_);
+        this->count_ = 0;
+        this->last_count_ = 0;
+    }
+    auto now = MFIButtonScanner::now_();
+    MFIButtonScanner::lock_();
+    this->pending_ += detents;
+    this->send_turn_(now);
+    if (turning) {
+        // Read until it stops
+        this->schedule_scan_(MFI_BUTTON_ENCODER_INTERVAL, now);
+    }
+    MFIButtonScanner::unlock_();
+}
+
+void MFI_BUTTON_ISR_ATTR MFIEncoder::scan_(unsigned long now) {
+    (void)now;
+    // This runs in the timer interrupt, the driver isn't safe to use there
+    this->request_work_();
+}
+
+#else
+
+bool MFIEncoder::begin() {
+    int interrupt_a = digitalPinToInterrupt(this->pin_a_);
+    int interrupt_b = digitalPinToInterrupt(this->pin_b_);
+    if (interrupt_a == NOT_AN_INTERRUPT || interrupt_b == NOT_AN_INTERRUPT) {
+        return false;
+    }
+    if (this->switch_ && !this->button_.begin()) {
+        return false;
+    }
+    MFIButtonScanner::init_timers_();
+    pinMode(this->pin_a_, INPUT_PULLUP);
+    pinMode(this->pin_b_, INPUT_PULLUP);
+    MFIButtonScanner::lock_();
+    this->state_ = (digitalRead(this->pin_a_) == HIGH ? 2 : 0) |
+                   (digitalRead(this->pin_b_) == HIGH ? 1 : 0);
+    SLIST_INSERT_HEAD(&encoders_, this, entries_);
+    MFIButtonScanner::unlock_();
+    MFIButtonScanner::attach_interrupt_(
+        interrupt_a, MFIEncoder::pin_interrupt_handler_, CHANGE);
+    MFIButtonScanner::attach_interrupt_(
+        interrupt_b, MFIEncoder::pin_interrupt_handler_, CHANGE);
+    return true;
+}
+
+void MFI_BUTTON_ISR_ATTR MFIEncoder::pin_interrupt_handler_() {
+    // There are very few encoders, and the ones that didn't move see no
+    // change in their state.
+    MFIEncoder *encoder;
+    SLIST_FOREACH(encoder, &encoders_, entries_) {
+        encoder->pins_changed_();
+    }
+}
+
+void MFI_BUTTON_ISR_ATTR MFIEncoder::pins_changed_() {
+    uint8_t state = (digitalRead(this->pin_a_) == HIGH ? 2 : 0) |
+                    (digitalRead(this->pin_b_) == HIGH ? 1 : 0);
+    if (state == this->state_) {
+        return;
+    }
+    int8_t step = mfi_encoder_transitions[this->state_ << 2 | state];
+    this->state_ = state;
+    this->count_ += step;
+    int16_t detents = 0;
+    if (this->count_ >= this->steps_) {
+        detents = 1;
+    } else if (this->count_ <= -this->steps_) {
+        detents = -1;
+    } else if (state == 3 && this->steps_ == 4) {
+        // Both high is where 4 step encoders rest, so after a missed edge
+        // the count gets back in line here.
+        this->count_ = 0;
+        return;
+    } else {
+        return;
+    }
+    this->count_ = 0;
+    auto now = MFIButtonScanner::now_();
+    MFIButtonScanner::lock_();
+    this->add_detents_(detents, now);
+    MFIButtonScanner::unlock_();
+}
+
+void MFI_BUTTON_ISR_ATTR MFIEncoder::add_detents_(int16_t detents,
+                                                  unsigned long now) {
+    // The first detent since the last event starts the wait for more
+    if (this->pending_ == 0 &&
+        !this->schedule_scan_(MFI_BUTTON_ENCODER_INTERVAL, now)) {
+        // No timer, so no waiting either
+        this->pending_ = detents;
+        this->send_turn_(now);
+        return;
+    }
+    this->pending_ += detents;
+}
+
+void MFI_BUTTON_ISR_ATTR MFIEncoder::scan_(unsigned long now) {
+    this->send_turn_(now);
+}
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef _MFIENCODER_H
+#define _MFIENCODER_H
+
+#include "MFIButton.h"
+
+// Count with the pulse counter (PCNT) peripheral, instead of pin interrupts
+#ifndef MFI_BUTTON_ENCODER_PCNT
+#if defined(ESP32) && defined(SOC_PCNT_SUPPORTED) && \
+    __has_include("driver/pulse_cnt.h")
+#define MFI_BUTTON_ENCODER_PCNT 1
+#else
+#define MFI_BUTTON_ENCODER_PCNT 0
+#endif
+#endif
+#if MFI_BUTTON_ENCODER_PCNT
+#include "driver/pulse_cnt.h"
+#endif
+
+// Detents are collected for this many ms after the first one, and then sent
+// as one event. With the pulse counter, this is also how often it's read
+// while the knob turns.
+#ifndef MFI_BUTTON_ENCODER_INTERVAL
+#define MFI_BUTTON_ENCODER_INTERVAL 10
+#endif
+// With acceleration, each this many detents per second count one time more
+#ifndef MFI_BUTTON_ENCODER_ACCEL_RATE
+#define MFI_BUTTON_ENCODER_ACCEL_RATE 20
+#endif
+
+// A quadrature rotary encoder, with A and B pulled up and the common pin to
+// ground. Turning sends TURN events, with the detents turned since the last
+// one in MFIButtonEvent::steps(). The switch of the knob, if it has one, is
+// a regular button.
+//
+// Without the pulse counter, both pins need interrupts, and every edge is
+// decoded with a state table. Bounce on one pin just moves back and forth
+// between two states, so it cancels out without any debounce time.
+//
+// With the pulse counter on ESP32, the edges are counted in hardware, and
+// there only is an interrupt when the count reaches a detent from rest.
+// After that it's read by MFIButton::dispatch() every
+// MFI_BUTTON_ENCODER_INTERVAL ms, from the timer queue, until the knob
+// stops. So however fast it's spun, there are no interrupts per detent.
+class MFIEncoder : public MFIButtonScanner {
+   public:
+    typedef MFIButton::event_callback_t event_callback_t;
+
+    // Pass -1 as switch_pin if there is no switch. steps is the number of
+    // edges from one detent to the next, 4 for most encoders.
+    MFIEncoder(uint8_t pin_a, uint8_t pin_b, int switch_pin = -1,
+               uint8_t steps = 4);
+    void onTurn(event_callback_t callback);
+    // Turning faster than MFI_BUTTON_ENCODER_ACCEL_RATE detents per second
+    // multiplies the detents in the events, up to factor times. The speed
+    // is taken from the time between events, 1 turns it off.
+    void setAcceleration(uint8_t factor);
+    MFIButton &button() { return this->button_; };
+    // Detents turned since begin(), without acceleration
+    int32_t getPosition();
+    bool begin();
+
+   protected:
+    void scan_(unsigned long now);
+#if MFI_BUTTON_ENCODER_PCNT
+    void work_();
+#endif
+
+   private:
+    // Sends the detents collected since the last event
+    void send_turn_(unsigned long now);
+#if MFI_BUTTON_ENCODER_PCNT
+    static bool watch_reached_(pcnt_unit_handle_t unit,
+                               const pcnt_watch_event_data_t *data,
+                               void *context);
+    pcnt_unit_handle_t unit_ = NULL;
+    // The count at the last detent, and at the last read
+    int count_ = 0;
+    int last_count_ = 0;
+#else
+    static SLIST_CLASS_HEAD(encoders_head_, MFIEncoder) encoders_;
+    static void pin_interrupt_handler_();
+    void pins_changed_();
+    // Adds detents, and makes sure an event will be sent for them
+    void add_detents_(int16_t detents, unsigned long now);
+    uint8_t state_ = 0;
+    // Edges since the last detent
+    int8_t count_ = 0;
+    SLIST_CLASS_ENTRY(MFIEncoder) entries_ = {NULL};
+#endif
+
+    uint8_t pin_a_;
+    uint8_t pin_b_;
+    uint8_t steps_;
+    bool switch_;
+    uint8_t acceleration_ = 1;
+    MFIButton button_;
+    event_callback_t on_turn_ = NULL;
+    int16_t pending_ = 0;
+    int32_t position_ = 0;
+    unsigned long last_turn_ = 0;
+};
+
+#endif  // _MFIENCODER_H
@@ -0,0 +1,267 @@
+#ifndef _MFISTATICBUTTON_H
+#define _MFISTATICBUTTON_H
+
+#include "MFIButton.h"
+
+// A button with its handlers fixed at compile time, for example:
+//
+//   MFIStaticButton<BUTTON_1, true, false,
+//                   MFIClick<on_click>,
+//                   MFISequence<3, on_triple_click>,
+//                   MFILongPress<1000, on_long_press>> button1;
+//
+// The handlers can be given in any order, they are sorted into constant
+// tables by the compiler, with sequences indexed by number of clicks. This
+// means no handler nodes on the heap and no lists to walk, but the button
+// runs the same state machine as any other MFIButton. Note that on AVR
+// constant data is still copied to RAM, it just doesn't carry list pointers
+// and heap overhead anymore.
+//
+// Template arguments can't be cast like the callback_t overloads do, so the
+// callbacks have to take the event parameter.
+
+// The interrupt handlers read the tables. Constant data is in flash on
+// ESP32, which they can't read while the cache is off, so there the tables
+// are left writable, which puts them in RAM.
+#if MFI_BUTTON_ISR_IN_RAM && defined(ESP32)
+#define MFI_STATIC_BUTTON_TABLE_CONST
+#else
+#define MFI_STATIC_BUTTON_TABLE_CONST const
+#endif
+
+template <uint8_t clicks, MFIButton::event_callback_t callback_>
+struct MFISequence {
+    // One more than the clicks, the size of the table, has to fit 8 bits
+    static_assert(clicks < 255, "A sequence can be at most 254 clicks");
+    static const bool is_sequence = true;
+    static constexpr uint16_t key() { return clicks; }
+    static constexpr MFIButton::event_callback_t callback() {
+        return callback_;
+    }
+};
+
+template <MFIButton::event_callback_t callback>
+using MFIClick = MFISequence<1, callback>;
+
+template <MFIButton::event_callback_t callback>
+using MFIDoubleClick = MFISequence<2, callback>;
+
+template <uint16_t duration, MFIButton::event_callback_t callback_>
+struct MFILongPress {
+    static const bool is_sequence = false;
+    static constexpr uint16_t key() { return duration; }
+    static constexpr MFIButton::event_callback_t callback() {
+        return callback_;
+    }
+};
+
+namespace mfi_static_button_ {
+
+template <uint8_t... i>
+struct indices {};
+template <uint8_t n, uint8_t... i>
+struct make_indices : make_indices<n - 1, n - 1, i...> {};
+template <uint8_t... i>
+struct make_indices<0, i...> {
+    typedef indices<i...> type;
+};
+
+// All the handlers of one kind (sequences or long presses) out of a
+// handler list. Sorting is done by rank: a handler's position in the table is
+// the number of handlers with a smaller key, so entry i is the handler whose
+// rank is i. That's quadratic, but only in the compiler.
+template <bool sequences, typename... handlers>
+struct kind;
+
+template <bool sequences>
+struct kind<sequences> {
+    static constexpr uint8_t count() { return 0; }
+    static constexpr uint8_t smaller(uint16_t) { return 0; }
+    static constexpr uint8_t equal(uint16_t) { return 0; }
+    template <typename all>
+    static constexpr bool unique() {
+        return true;
+    }
+    template <typename all>
+    static constexpr uint16_t key_at(uint8_t) {
+        return 0;
+    }
+    template <typename all>
+    static constexpr MFIButton::event_callback_t callback_at(uint8_t) {
+        return NULL;
+    }
+    static constexpr MFIButton::event_callback_t callback_for(uint16_t) {
+        return NULL;
+    }
+};
+
+template <bool sequences, typename handler, typename... rest>
+struct kind<sequences, handler, rest...> {
+    typedef kind<sequences, rest...> next;
+    static constexpr bool mine() { return handler::is_sequence == sequences; }
+    static constexpr uint8_t count() { return mine() + next::count(); }
+    static constexpr uint8_t smaller(uint16_t key) {
+        return (mine() && handler::key() < key) + next::smaller(key);
+    }
+    static constexpr uint8_t equal(uint16_t key) {
+        return (mine() && handler::key() == key) + next::equal(key);
+    }
+    template <typename all>
+    static constexpr bool unique() {
+        return (!mine() || all::equal(handler::key()) == 1) &&
+               next::template unique<all>();
+    }
+    template <typename all>
+    static constexpr uint16_t key_at(uint8_t i) {
+        return mine() && all::smaller(handler::key()) == i
+                   ? handler::key()
+                   : next::template key_at<all>(i);
+    }
+    template <typename all>
+    static constexpr MFIButton::event_callback_t callback_at(uint8_t i) {
+        return mine() && all::smaller(handler::key()) == i
+                   ? handler::callback()
+                   : next::template callback_at<all>(i);
+    }
+    static constexpr MFIButton::event_callback_t callback_for(uint16_t key) {
+        return mine() && handler::key() == key ? handler::callback()
+                                               : next::callback_for(key);
+    }
+};
+
+// The sorted table itself. It has an extra empty entry at the end, because
+// arrays can't be empty.
+template <typename maker, typename all, typename index>
+struct table;
+
+template <typename maker, typename all, uint8_t... i>
+struct table<maker, all, indices<i...>> {
+    static MFI_STATIC_BUTTON_TABLE_CONST typename maker::type
+        entries[sizeof...(i) + 1];
+};
+
+template <typename maker, typename all, uint8_t... i>
+MFI_STATIC_BUTTON_TABLE_CONST typename maker::type
+    table<maker, all, indices<i...>>::entries[sizeof...(i) + 1] = {
+        maker::make(all::template key_at<all>(i),
+                    all::template callback_at<all>(i))...,
+        maker::make(0, NULL)};
+
+// Callbacks indexed by key, with NULL for keys that have no handler
+template <typename all, typename index>
+struct dense_table;
+
+template <typename all, uint8_t... i>
+struct dense_table<all, indices<i...>> {
+    static MFI_STATIC_BUTTON_TABLE_CONST MFIButton::event_callback_t
+        entries[sizeof...(i)];
+};
+
+template <typename all, uint8_t... i>
+MFI_STATIC_BUTTON_TABLE_CONST MFIButton::event_callback_t
+    dense_table<all, indices<i...>>::entries[sizeof...(i)] = {
+        all::callback_for(i)...};
+
+// The sorted sequences linked into a list, like onSequence() keeps them when
+// a table by clicks would be mostly empty. Not constant, as the list isn't.
+template <typename node, typename all, typename index>
+struct sequence_list;
+
+template <typename node, typename all, uint8_t... i>
+struct sequence_list<node, all, indices<i...>> {
+    static node entries[sizeof...(i)];
+};
+
+template <typename node, typename all, uint8_t... i>
+node sequence_list<node, all, indices<i...>>::entries[sizeof...(i)] = {
+    {(uint8_t)all::template key_at<all>(i), all::template callback_at<all>(i),
+     {i + 1 < sizeof...(i) ? &entries[i + 1] : NULL}}...};
+
+}  // namespace mfi_static_button_
+
+template <uint8_t pin, bool pullup, bool inverted, typename... handlers>
+class MFIStaticButton : public MFIButton {
+    typedef mfi_static_button_::kind<true, handlers...> sequence_kind_;
+    typedef mfi_static_button_::kind<false, handlers...> long_press_kind_;
+    static_assert(sequence_kind_::template unique<sequence_kind_>(),
+                  "Only one handler per number of clicks");
+    static_assert(long_press_kind_::template unique<long_press_kind_>(),
+                  "Only one handler per long press duration");
+
+    // The most clicks of any handler, 0 if there are none
+    static constexpr uint8_t longest_sequence() {
+        return sequence_kind_::template key_at<sequence_kind_>(
+            sequence_kind_::count() - 1);
+    }
+    struct long_press_maker_ {
+        typedef long_press_t_ type;
+        static constexpr type make(uint16_t key, event_callback_t callback) {
+            return type{key, callback};
+        }
+    };
+    typedef mfi_static_button_::dense_table<
+        sequence_kind_, typename mfi_static_button_::make_indices<
+                            longest_sequence() + 1>::type>
+        sequence_entries_;
+    typedef mfi_static_button_::sequence_list<
+        sequence_t_, sequence_kind_,
+        typename mfi_static_button_::make_indices<
+            sequence_kind_::count()>::type>
+        sequence_list_;
+    typedef mfi_static_button_::table<
+        long_press_maker_, long_press_kind_,
+        typename mfi_static_button_::make_indices<
+            long_press_kind_::count()>::type>
+        long_press_table_;
+
+    // Buttons with the same handlers share the profile, like the tables
+    static MFIButtonProfile static_profile_;
+
+    // Only the one that's used is instantiated, so a button with many clicks
+    // doesn't get a table it won't use
+    template <bool>
+    struct dense_ {};
+    static void set_sequences_(MFIButtonProfile *profile, dense_<true>) {
+        profile->sequence_table_ = sequence_entries_::entries;
+        profile->sequence_table_size_ = longest_sequence() + 1;
+    }
+    static void set_sequences_(MFIButtonProfile *profile, dense_<false>) {
+        SLIST_FIRST(&profile->sequence_handlers_) = sequence_list_::entries;
+    }
+
+   public:
+    MFIStaticButton() : MFIButton(pin, pullup, inverted) {
+        // The tables are sorted, so the last entries are the longest
+        MFIButtonProfile *profile = &static_profile_;
+        if (sequence_kind_::count() != 0) {
+            set_sequences_(profile,
+                           dense_<longest_sequence() <=
+                                  MFI_BUTTON_SEQUENCE_TABLE_MAX>());
+            profile->longest_sequence_ = longest_sequence();
+        }
+        if (long_press_kind_::count() != 0) {
+            profile->long_presses_ = long_press_table_::entries;
+            profile->long_press_count_ = long_press_kind_::count();
+            profile->longest_long_press_ =
+                long_press_table_::entries[long_press_kind_::count() - 1]
+                    .duration;
+        }
+        this->profile_ = profile;
+    }
+
+    // The handlers are fixed, so these are not available
+    void onSequence(uint8_t clicks, event_callback_t callback) = delete;
+    void onSequence(uint8_t clicks, callback_t callback) = delete;
+    void onClick(event_callback_t callback) = delete;
+    void onClick(callback_t callback) = delete;
+    void onDoubleClick(event_callback_t callback) = delete;
+    void onDoubleClick(callback_t callback) = delete;
+    void onLongPress(uint16_t duration, event_callback_t callback) = delete;
+    void onLongPress(uint16_t duration, callback_t callback) = delete;
+};
+
+template <uint8_t pin, bool pullup, bool inverted, typename... handlers>
+MFIButtonProfile MFIStaticButton<pin, pullup, inverted,
+                                 handlers...>::static_profile_;
+
+#endif  // _MFISTATICBUTTON_H